@@ -0,0 +1,569 @@
+/**
+ * @brief Headless benchmark of the rendering pipeline.
+ * @author Jakub Kloub, xkloub03, VUT FIT
+ * @file bench.cpp
+ */
+#include "render/FetchKernel.h"
+#include "render/render.h"
+#include "render/RasterKernel.h"
+#include <swrast.h>
+#include <glm/gtc/constants.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <string>
+
+using namespace swrast;
+
+/// Uniform block of the benchmark program (binding 0).
+struct Transform {
+  glm::mat4 mvp;
+};
+
+void vertex_shader(VertexContext* vs) {
+  auto aPos = vs->Attribute<glm::vec3>(0).value().get();
+  auto aColor = vs->Attribute<glm::vec3>(1).value().get();
+  auto& color = vs->Out<glm::vec3>("color"_sid);
+  const auto& mvp = vs->UniformBlock<Transform>(0).mvp;
+
+  color = aColor;
+  vs->m_Position = mvp * glm::vec4(aPos, 1.0f);
+}
+
+/// The same shader as vertex_shader(), processing WIDE_LANES vertices at once.
+void vertex_shader_batch(VertexContext* vs, VertexBatch& batch) {
+  auto aPos = batch.Attribute<glm::vec3>(0).value();
+  auto aColor = batch.Attribute<glm::vec3>(1).value();
+  const auto& mvp = vs->UniformBlock<Transform>(0).mvp;
+
+  batch.Out(vs->GetVaryingSlot("color"_sid), aColor);
+  batch.m_Position = mvp * wvec4(aPos, 1.0f);
+}
+
+/// Batched shader placing each instance of the mesh by its per instance attribute (offset and scale).
+void vertex_shader_instanced(VertexContext* vs, VertexBatch& batch) {
+  auto aPos = batch.Attribute<glm::vec3>(0).value();
+  auto aColor = batch.Attribute<glm::vec3>(1).value();
+  auto aInstance = batch.Attribute<glm::vec4>(2).value();
+  const auto& mvp = vs->UniformBlock<Transform>(0).mvp;
+
+  WVec3 offset;
+  offset.c = { aInstance[0], aInstance[1], aInstance[2] };
+  batch.Out(vs->GetVaryingSlot("color"_sid), aColor);
+  batch.m_Position = mvp * wvec4(aPos * aInstance[3] + offset, 1.0f);
+}
+
+void fragment_shader(FragmentContext* fs) {
+  auto& color = fs->In<glm::vec3>("color"_sid);
+
+  fs->m_FragColor = glm::vec4(color, 1.0f);
+}
+
+/// The same shader as fragment_shader(), processing a whole FragmentBatch at once.
+void fragment_shader_batch(FragmentContext* fs, FragmentBatch& batch) {
+  auto color = batch.In<glm::vec3>(fs->GetVaryingSlot("color"_sid));
+
+  batch.m_FragColor = wvec4(color, 1.0f);
+}
+
+struct BenchOptions {
+  glm::uvec2 size = { 800, 600 };
+  uint32_t frames = 10;
+  /// Number of rings and segments of the sphere.
+  uint32_t sphere_segments = 512;
+  RasterMode raster = RasterMode::Float;
+  StateSpec spec{};
+};
+
+/// Geometry drawn by the benchmark.
+struct Scene {
+  ObjectHandle<VertexArray> vao;
+  size_t index_count;
+  glm::mat4 mvp;
+  Primitive primitive = Primitive::Triangles;
+  /// Whether the indices contain restart indices.
+  bool primitive_restart = false;
+};
+
+/// Append UV sphere with given number of rings and segments to the interleaved position and color vertices.
+void generate_sphere(uint32_t segments, glm::vec3 center, float radius, VertexBuffer::Data& vertices,
+                     IndexBuffer::Data& indices) {
+  const uint32_t first = vertices.size() / 6;
+  vertices.reserve(vertices.size() + (segments + 1) * (segments + 1) * 6);
+  for (uint32_t i = 0; i <= segments; i++) {
+    for (uint32_t j = 0; j <= segments; j++) {
+      float theta = glm::pi<float>() * i / segments;
+      float phi = 2.0f * glm::pi<float>() * j / segments;
+      glm::vec3 n = { std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi) };
+      glm::vec3 p = center + radius * n;
+      glm::vec3 color = 0.5f + 0.5f * n;
+      vertices.insert(vertices.end(), { p.x, p.y, p.z, color.r, color.g, color.b });
+    }
+  }
+
+  indices.reserve(indices.size() + segments * segments * 6);
+  for (uint32_t i = 0; i < segments; i++) {
+    for (uint32_t j = 0; j < segments; j++) {
+      uint32_t a = first + i * (segments + 1) + j;
+      uint32_t b = a + segments + 1;
+      indices.insert(indices.end(), { a, b, a + 1, a + 1, b, b + 1 });
+    }
+  }
+}
+
+/**
+ * @brief Create scene of interleaved position and color vertices. The unit sphere fills most of the screen.
+ * @param primitive_restart Whether the indices contain restart indices (like strips made by MeshOptimizer::Stripify()).
+ */
+Scene create_scene(VertexBuffer::Data&& vertices, IndexBuffer::Data&& indices, glm::uvec2 fb_size,
+                   Primitive primitive = Primitive::Triangles, bool primitive_restart = false) {
+  size_t index_count = indices.size();
+
+  auto vbo = State::CreateObject(VertexBuffer(std::move(vertices)));
+  auto ibo = State::CreateObject(IndexBuffer(std::move(indices)));
+  // Spheres with less than 256 segments fit into 16-bit indices.
+  ibo->Compact(primitive_restart);
+  auto vao = State::CreateObject(VertexArray({
+    { vbo, AttributeType::Vec3, 6 * sizeof(float), 0 },
+    { vbo, AttributeType::Vec3, 6 * sizeof(float), 3 * sizeof(float) },
+  }, ibo));
+
+  float aspect = (float)fb_size.x / fb_size.y;
+  glm::mat4 projection = glm::perspective(glm::radians(45.0f), aspect, 0.1f, 20.0f);
+  glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 0.3f, 2.8f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+  glm::mat4 model = glm::rotate(glm::mat4(1.0f), 0.7f, glm::vec3(0.3f, 1.0f, 0.1f));
+  return { vao, index_count, projection * view * model, primitive, primitive_restart };
+}
+
+/// Create UV sphere with given number of rings and segments, which fills most of the screen.
+Scene create_sphere(uint32_t segments, glm::uvec2 fb_size) {
+  VertexBuffer::Data vertices;
+  IndexBuffer::Data indices;
+  generate_sphere(segments, glm::vec3(0.0f), 1.0f, vertices, indices);
+  return create_scene(std::move(vertices), std::move(indices), fb_size);
+}
+
+/// Create a quad covering the whole screen.
+Scene create_fullscreen_quad() {
+  auto vbo = State::CreateObject(VertexBuffer({
+    -1.0f, -1.0f, 0.0f, 1.0f, 0.0f, 0.0f,
+     1.0f, -1.0f, 0.0f, 0.0f, 1.0f, 0.0f,
+     1.0f,  1.0f, 0.0f, 0.0f, 0.0f, 1.0f,
+    -1.0f,  1.0f, 0.0f, 1.0f, 1.0f, 1.0f,
+  }));
+  auto ibo = State::CreateObject(IndexBuffer({ 0, 1, 2, 0, 2, 3 }));
+  auto vao = State::CreateObject(VertexArray({
+    { vbo, AttributeType::Vec3, 6 * sizeof(float), 0 },
+    { vbo, AttributeType::Vec3, 6 * sizeof(float), 3 * sizeof(float) },
+  }, ibo));
+  return { vao, 6, glm::mat4(1.0f) };
+}
+
+/// Copies of a mesh placed in a grid.
+struct Instances {
+  /// Offset and scale of each instance.
+  std::vector<glm::vec4> transforms;
+  /// The mesh with the per instance attribute at location 2.
+  ObjectHandle<VertexArray> vao;
+};
+
+/// Place `grid * grid` copies of the mesh in a grid covering the space of the unit sphere.
+Instances create_instances(const Scene& mesh, uint32_t grid) {
+  Instances instances;
+  VertexBuffer::Data data;
+  float scale = 1.0f / grid;
+  for (uint32_t y = 0; y < grid; y++) {
+    for (uint32_t x = 0; x < grid; x++) {
+      glm::vec4 t = { (2.0f * x + 1.0f) * scale - 1.0f, (2.0f * y + 1.0f) * scale - 1.0f, 0.0f, 0.8f * scale };
+      instances.transforms.push_back(t);
+      data.insert(data.end(), { t.x, t.y, t.z, t.w });
+    }
+  }
+  auto vbo = State::CreateObject(VertexBuffer(std::move(data)));
+  VertexArray::Data attributes = mesh.vao->GetAttributes();
+  attributes.push_back({ vbo, AttributeType::Vec4, 4 * sizeof(float), 0, 1 });
+  instances.vao = State::CreateObject(VertexArray(std::move(attributes), mesh.vao->GetIndexBuffer()));
+  return instances;
+}
+
+struct BenchResult {
+  double ms_per_frame;
+  /// Statistics of the last frame.
+  RenderStats stats;
+};
+
+/// Render the scene several times and measure the average frame time.
+BenchResult run_scene(Scene& scene, ObjectHandle<Framebuffer> fb, ObjectHandle<Program> prg, uint32_t frames) {
+  fb->Use();
+  prg->Use();
+  prg->SetUniform(Transform{ scene.mvp });
+  scene.vao->Use();
+  State::m_DepthTest = true;
+  State::m_PrimitiveRestart = scene.primitive_restart;
+
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < frames; i++) {
+    State::Clear(Colors::Gray);
+    State::DrawIndexed(scene.primitive, scene.index_count);
+  }
+  std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+  return { elapsed.count() / frames, RenderState::stats };
+}
+
+/**
+ * @brief Measure the vertex processing throughput.
+ *
+ * The scene is moved out of the view frustum, so all triangles are trivially rejected right after
+ * the vertex shader and primitive assembly.
+ * @param draw Function submitting the scene geometry. By default the whole scene is drawn at once.
+ * @return Milliseconds per draw call.
+ */
+double run_vertices(Scene& scene, ObjectHandle<Program> prg, uint32_t frames, const std::function<void()>& draw = {}) {
+  prg->Use();
+  prg->SetUniform(Transform{ glm::translate(glm::mat4(1.0f), glm::vec3(1000.0f, 0.0f, 0.0f)) * scene.mvp });
+  scene.vao->Use();
+  State::m_PrimitiveRestart = scene.primitive_restart;
+
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < frames; i++) {
+    if (draw)
+      draw();
+    else
+      State::DrawIndexed(scene.primitive, scene.index_count);
+  }
+  std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+  return elapsed.count() / frames;
+}
+
+/**
+ * @brief Render all the instances several times and measure the average frame time.
+ * @param prg Program with the instanced shader. Without it each instance is drawn separately.
+ */
+BenchResult run_instances(Scene& mesh, Instances& instances, ObjectHandle<Framebuffer> fb, ObjectHandle<Program> prg,
+                          Opt<ObjectHandle<Program>> prg_instanced, uint32_t frames) {
+  fb->Use();
+  State::m_DepthTest = true;
+  State::m_PrimitiveRestart = false;
+
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < frames; i++) {
+    State::Clear(Colors::Gray);
+    if (prg_instanced.has_value()) {
+      prg_instanced.value()->Use();
+      prg_instanced.value()->SetUniform(Transform{ mesh.mvp });
+      instances.vao->Use();
+      State::DrawIndexedInstanced(Primitive::Triangles, mesh.index_count, instances.transforms.size());
+    } else {
+      prg->Use();
+      mesh.vao->Use();
+      for (const glm::vec4& t : instances.transforms) {
+        glm::mat4 model = glm::scale(glm::translate(glm::mat4(1.0f), glm::vec3(t)), glm::vec3(t.w));
+        prg->SetUniform(Transform{ mesh.mvp * model });
+        State::DrawIndexed(Primitive::Triangles, mesh.index_count);
+      }
+    }
+  }
+  std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+  return { elapsed.count() / frames, RenderState::stats };
+}
+
+/// Fetch the attribute by copying each lane separately, as done before the fetch kernels.
+void fetch_generic(const AttributeStream& stream, const uint32_t* vertex_ids, float* out) {
+  uint32_t components = get_byte_size(stream.type) / sizeof(float);
+  for (uint8_t lane = 0; lane < WIDE_LANES; lane++) {
+    float x[16];
+    std::memcpy(x, stream.data + stream.stride * vertex_ids[lane], get_byte_size(stream.type));
+    for (uint32_t c = 0; c < components; c++)
+      out[c * WIDE_LANES + lane] = x[c];
+  }
+}
+
+/**
+ * @brief Fetch all attributes of the vertices in batches, the way batched shaders do.
+ * @param fetch Function fetching a single attribute of a batch.
+ * @return Milliseconds per pass over all the vertices.
+ */
+template<class Fetch>
+double run_fetch(const std::vector<AttributeStream>& streams, const std::vector<uint32_t>& vertex_ids,
+                 uint32_t passes, Fetch fetch) {
+  WVec4 values;
+  float sink = 0.0f;
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t pass = 0; pass < passes; pass++) {
+    for (size_t i = 0; i + WIDE_LANES <= vertex_ids.size(); i += WIDE_LANES) {
+      for (const AttributeStream& stream : streams) {
+        fetch(stream, vertex_ids.data() + i, &values[0][0]);
+        sink += values[0][0];
+      }
+    }
+  }
+  std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+  // Keep the fetched values alive, so the compiler can't skip the fetches.
+  volatile float keep = sink;
+  (void)keep;
+  return elapsed.count() / passes;
+}
+
+void print_fetch_result(const char* name, double ms, size_t attributes) {
+  std::printf("  %-24s %9.2f ms/pass  %9.2f Mattr/s\n", name, ms, attributes / (ms * 1e-3) * 1e-6);
+}
+
+void print_vertex_result(const char* name, double ms, size_t vertices) {
+  const RenderStats& stats = RenderState::stats;
+  std::printf("  %-24s %9.2f ms/draw  %9.2f Mvert/s   shaded/indices: %.2f\n", name, ms,
+    vertices / (ms * 1e-3) * 1e-6, (double)stats.vertices_shaded / stats.indices_processed);
+}
+
+void print_result(const char* name, const BenchResult& result, size_t triangles) {
+  double tri_per_sec = triangles / (result.ms_per_frame * 1e-3);
+  std::printf("  %-24s %9.2f ms/frame %9.2f Mtri/s   small: %" PRIu64 ", fragments: %" PRIu64 " shaded, %" PRIu64 " killed early\n",
+    name, result.ms_per_frame, tri_per_sec * 1e-6, result.stats.small_triangles, result.stats.fragments_shaded,
+    result.stats.fragments_early_killed);
+}
+
+void print_fill_result(const char* name, const BenchResult& result) {
+  double pix_per_sec = result.stats.fragments_shaded / (result.ms_per_frame * 1e-3);
+  std::printf("  %-24s %9.2f ms/frame %9.2f Mpix/s   helpers: %" PRIu64 "\n",
+    name, result.ms_per_frame, pix_per_sec * 1e-6, result.stats.helper_invocations);
+}
+
+/// Print size of the scene's index buffer.
+void print_index_size(const char* name, const Scene& scene) {
+  const IndexBuffer& ibo = *scene.vao->GetIndexBuffer();
+  const size_t index_size = ibo.GetType() == IndexType::UInt8 ? 1 : ibo.GetType() == IndexType::UInt16 ? 2 : 4;
+  std::printf("  %-24s %9lu indices %9lu bytes\n", name, ibo.Size(), ibo.Size() * index_size);
+}
+
+void print_mesh_report(const char* name, const MeshOptimizeReport& report) {
+  const MeshStats& a = report.before;
+  const MeshStats& b = report.after;
+  std::printf("  %-24s ACMR %.3f -> %.3f  ATVR %.3f -> %.3f  overdraw %.3f -> %.3f  overfetch %.3f -> %.3f\n",
+    name, a.acmr, b.acmr, a.atvr, b.atvr, a.overdraw, b.overdraw, a.overfetch, b.overfetch);
+}
+
+void print_usage() {
+  std::cerr <<
+    "Usage: bench [options]\n"
+    "  --frames N       Number of rendered frames per measurement (default 10).\n"
+    "  --size WxH       Framebuffer size (default 800x600).\n"
+    "  --segments N     Rings and segments of the sphere (default 512).\n"
+    "  --fixed          Use fixed point rasterization.\n"
+    "  --tiled [N]      Use tiled backend with N workers (default all cores).\n"
+    "  --simd ISA       Highest used instruction set: scalar, sse2 or avx2.\n";
+}
+
+/// Parse the command line. Returns false on invalid arguments.
+bool parse_options(int argc, char** argv, BenchOptions& opts) {
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    const auto next = [&]{ return argv[++i]; };
+    if (arg == "--frames" && i + 1 < argc)
+      opts.frames = std::stoul(next());
+    else if (arg == "--size" && i + 1 < argc) {
+      if (std::sscanf(next(), "%ux%u", &opts.size.x, &opts.size.y) != 2)
+        return false;
+    } else if (arg == "--segments" && i + 1 < argc)
+      opts.sphere_segments = std::stoul(next());
+    else if (arg == "--fixed")
+      opts.raster = RasterMode::FixedPoint;
+    else if (arg == "--tiled") {
+      opts.spec.backend = RenderBackend::Tiled;
+      if (i + 1 < argc && argv[i + 1][0] != '-')
+        opts.spec.worker_count = std::stoul(next());
+    } else if (arg == "--simd" && i + 1 < argc) {
+      std::string isa = next();
+      if (isa == "scalar")
+        opts.spec.simd_isa = SimdIsa::Scalar;
+      else if (isa == "sse2")
+        opts.spec.simd_isa = SimdIsa::SSE2;
+      else if (isa == "avx2")
+        opts.spec.simd_isa = SimdIsa::AVX2;
+      else
+        return false;
+    } else
+      return false;
+  }
+  return opts.frames > 0 && opts.sphere_segments > 0 && opts.size.x > 0 && opts.size.y > 0;
+}
+
+int main(int argc, char** argv) {
+  BenchOptions opts;
+  if (!parse_options(argc, argv, opts)) {
+    print_usage();
+    return 1;
+  }
+
+  try {
+    State::Init(opts.size, opts.spec);
+    State::m_RasterMode = opts.raster;
+    auto fb = State::CreateObject(Framebuffer::CreateBasic(opts.size));
+    // Both programs share the transform block.
+    auto transform = State::CreateObject(UniformBuffer::Create<Transform>());
+    auto prg = State::CreateObject(Program({
+      .vertex_shader = State::CreateObject(VertexShader(vertex_shader)),
+      .fragment_shader = State::CreateObject(FragmentShader(fragment_shader)),
+      .varyings = { { "color"_sid, VaryingType::Vec3 } },
+      .uniform_blocks = { transform },
+    }));
+    auto prg_batch = State::CreateObject(Program({
+      .vertex_shader = State::CreateObject(VertexShader(vertex_shader_batch)),
+      .fragment_shader = State::CreateObject(FragmentShader(fragment_shader_batch)),
+      .varyings = { { "color"_sid, VaryingType::Vec3 } },
+      .uniform_blocks = { transform },
+    }));
+
+    std::printf("%ux%u, %s raster, %s, %s backend\n", opts.size.x, opts.size.y,
+      opts.raster == RasterMode::FixedPoint ? "fixed point" : "float", to_string(RenderState::isa),
+      opts.spec.backend == RenderBackend::Tiled ? "tiled" : "serial");
+
+    // Tessellated sphere with most triangles covering just a few pixels.
+    Scene sphere = create_sphere(opts.sphere_segments, opts.size);
+    size_t triangles = sphere.index_count / 3;
+    std::printf("sphere: %u segments, %zu triangles\n", opts.sphere_segments, triangles);
+    State::m_SmallTriangles = false;
+    print_result("small triangles off", run_scene(sphere, fb, prg, opts.frames), triangles);
+    State::m_SmallTriangles = true;
+    print_result("small triangles on", run_scene(sphere, fb, prg, opts.frames), triangles);
+
+    // The sphere split into small meshes, drawn one by one and by a single multi-draw.
+    constexpr uint32_t MESH_INDICES = 96;
+    std::vector<DrawRecord> meshes;
+    for (uint32_t first = 0; first < sphere.index_count; first += MESH_INDICES)
+      meshes.push_back({ std::min<uint32_t>(MESH_INDICES, sphere.index_count - first), first, 0 });
+    auto indirect = State::CreateObject(IndirectBuffer(std::move(std::vector<DrawRecord>(meshes))));
+    std::printf("draw submission: %zu meshes of %u indices\n", meshes.size(), MESH_INDICES);
+    print_vertex_result("draw per mesh", run_vertices(sphere, prg_batch, opts.frames, [&]{
+      for (const DrawRecord& mesh : meshes)
+        State::DrawIndexed(Primitive::Triangles, mesh.count, mesh.first, mesh.base_vertex);
+    }), sphere.index_count);
+    print_vertex_result("multi-draw", run_vertices(sphere, prg_batch, opts.frames, [&]{
+      State::MultiDrawIndexed(Primitive::Triangles, meshes);
+    }), sphere.index_count);
+    print_vertex_result("multi-draw indirect", run_vertices(sphere, prg_batch, opts.frames, [&]{
+      State::MultiDrawIndexedIndirect(Primitive::Triangles, indirect);
+    }), sphere.index_count);
+
+    // Attribute fetch of the demo's interleaved layout (position and color), by sequential and
+    // shuffled (like indexed draws) vertex IDs.
+    constexpr uint32_t FETCH_VERTICES = 1 << 16;
+    constexpr uint32_t FETCH_PASSES = 100;
+    VertexBuffer::Data fetch_data(FETCH_VERTICES * 6);
+    std::iota(fetch_data.begin(), fetch_data.end(), 0.0f);
+    auto fetch_vbo = State::CreateObject(VertexBuffer(std::move(fetch_data)));
+    VertexArray fetch_vao({
+      { fetch_vbo, AttributeType::Vec3, 6 * sizeof(float), 0 },
+      { fetch_vbo, AttributeType::Vec3, 6 * sizeof(float), 3 * sizeof(float) },
+    });
+    const std::vector<AttributeStream> fetch_streams = fetch_vao.GetStreams();
+    std::vector<uint32_t> sequential(FETCH_VERTICES);
+    std::iota(sequential.begin(), sequential.end(), 0);
+    std::vector<uint32_t> shuffled = sequential;
+    std::shuffle(shuffled.begin(), shuffled.end(), std::mt19937(42));
+    size_t fetched = (size_t)FETCH_VERTICES * fetch_streams.size();
+    std::printf("attribute fetch: %u vertices, vec3 + vec3 interleaved\n", FETCH_VERTICES);
+    for (const auto& [order, ids] : { std::pair{ "sequential", &sequential }, std::pair{ "shuffled", &shuffled } }) {
+      std::string name = std::string("generic, ") + order;
+      print_fetch_result(name.c_str(), run_fetch(fetch_streams, *ids, FETCH_PASSES, fetch_generic), fetched);
+      for (SimdIsa isa : { SimdIsa::Scalar, SimdIsa::AVX2 }) {
+        if (isa > RenderState::isa)
+          continue;
+        FetchKernel kernel = get_fetch_kernel(3, true, isa);
+        name = std::string(to_string(isa)) + " kernel, " + order;
+        print_fetch_result(name.c_str(), run_fetch(fetch_streams, *ids, FETCH_PASSES,
+          [kernel](const AttributeStream& stream, const uint32_t* vertex_ids, float* out) {
+            kernel(stream.data, stream.stride, vertex_ids, out);
+          }), fetched);
+      }
+    }
+
+    // Vertex shader alone with single vertex and batched entry points.
+    std::printf("vertex shader: %zu vertices\n", sphere.index_count);
+    print_vertex_result("single vertex", run_vertices(sphere, prg, opts.frames), sphere.index_count);
+    print_vertex_result("batched", run_vertices(sphere, prg_batch, opts.frames), sphere.index_count);
+
+    // Mesh optimizer on a cluster of overlapping spheres with shuffled triangles (like raw exporter output).
+    {
+      VertexBuffer::Data vertices;
+      IndexBuffer::Data indices;
+      for (int i = 0; i < 8; i++) {
+        float angle = 2.0f * glm::pi<float>() * i / 8;
+        glm::vec3 center = { 0.5f * std::cos(angle), 0.3f * std::sin(2.0f * angle), 0.5f * std::sin(angle) };
+        generate_sphere(64, center, 0.45f, vertices, indices);
+      }
+      std::vector<uint32_t> order(indices.size() / 3);
+      std::iota(order.begin(), order.end(), 0);
+      std::shuffle(order.begin(), order.end(), std::mt19937(7));
+      IndexBuffer::Data shuffled;
+      for (uint32_t t : order)
+        shuffled.insert(shuffled.end(), indices.begin() + t * 3, indices.begin() + t * 3 + 3);
+
+      std::printf("mesh optimizer: 8 spheres, %zu triangles\n", shuffled.size() / 3);
+      MeshOptimizer optimizer(IndexBuffer::Data(shuffled), VertexBuffer::Data(vertices), 6);
+      print_mesh_report("vertex cache", optimizer.OptimizeVertexCache());
+      print_mesh_report("overdraw", optimizer.OptimizeOverdraw());
+      print_mesh_report("vertex fetch", optimizer.OptimizeVertexFetch());
+      IndexBuffer::Data strips = optimizer.Stripify();
+
+      size_t mesh_triangles = shuffled.size() / 3;
+      Scene raw = create_scene(std::move(vertices), std::move(shuffled), opts.size);
+      VertexBuffer::Data strip_vertices = optimizer.vertices;
+      Scene optimized = create_scene(std::move(optimizer.vertices), std::move(optimizer.indices), opts.size);
+      Scene stripified = create_scene(std::move(strip_vertices), std::move(strips), opts.size,
+                                      Primitive::TriangleStrip, true);
+      print_vertex_result("raw vertices", run_vertices(raw, prg_batch, opts.frames), raw.index_count);
+      print_vertex_result("optimized vertices", run_vertices(optimized, prg_batch, opts.frames), optimized.index_count);
+      print_result("raw", run_scene(raw, fb, prg_batch, opts.frames), mesh_triangles);
+      print_result("optimized", run_scene(optimized, fb, prg_batch, opts.frames), mesh_triangles);
+
+      // The optimized triangle list converted to strips separated by the primitive restart index.
+      std::printf("primitive restart: optimized mesh as triangle list and strips\n");
+      print_index_size("list indices", optimized);
+      print_index_size("strip indices", stripified);
+      // Throughput is counted in the list's vertices, as strips submit fewer indices for the same triangles.
+      print_vertex_result("list vertices", run_vertices(optimized, prg_batch, opts.frames), optimized.index_count);
+      print_vertex_result("strip vertices", run_vertices(stripified, prg_batch, opts.frames), optimized.index_count);
+      print_result("strips", run_scene(stripified, fb, prg_batch, opts.frames), mesh_triangles);
+    }
+
+    // Crowd of small meshes, drawn one by one and by a single instanced draw.
+    constexpr uint32_t INSTANCE_GRID = 64;
+    auto prg_instanced = State::CreateObject(Program({
+      .vertex_shader = State::CreateObject(VertexShader(vertex_shader_instanced)),
+      .fragment_shader = State::CreateObject(FragmentShader(fragment_shader_batch)),
+      .varyings = { { "color"_sid, VaryingType::Vec3 } },
+      .uniform_blocks = { transform },
+    }));
+    Scene mesh = create_sphere(8, opts.size);
+    Instances instances = create_instances(mesh, INSTANCE_GRID);
+    size_t instance_triangles = mesh.index_count / 3 * instances.transforms.size();
+    std::printf("instancing: %zu instances of %zu triangles\n", instances.transforms.size(), mesh.index_count / 3);
+    print_result("draw per instance", run_instances(mesh, instances, fb, prg_batch, {}, opts.frames),
+                 instance_triangles);
+    print_result("instanced", run_instances(mesh, instances, fb, prg_batch, prg_instanced, opts.frames),
+                 instance_triangles);
+
+    // Fill rate of the fragment shader with single fragment and batched entry points.
+    Scene quad = create_fullscreen_quad();
+    std::printf("fill rate: full screen quad\n");
+    print_fill_result("single fragment", run_scene(quad, fb, prg, opts.frames));
+    print_fill_result("batched", run_scene(quad, fb, prg_batch, opts.frames));
+
+    State::Destroy();
+  } catch (const swrast::Exception& e) {
+    std::cerr << "[\033[31m!! EXCEPTION !!\033[0m] " << e.what() << std::endl;
+    return 1;
+  } catch (const std::exception& e) {
+    std::cerr << "[\033[31m!! EXCEPTION !!\033[0m] " << e.what() << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
@@ -6,6 +6,7 @@
 #pragma once
 #include "ren_utils/basic.h"
 #include "swrast_private.h"
+#include "utils.h"
 #include <atomic>
 #include <exception>
 #include <string>
@@ -41,4 +42,22 @@ namespace swrast {
       m_msg += strfmt("Object with ID = %i could not be found.", id);
     }
   };
+
+  struct ProgramLinkException : public Exception {
+    ProgramLinkException(const char* file, int line, const char* reason) : Exception(file, line) {
+      m_msg += strfmt("Program link failed: %s", reason);
+    }
+  };
+
+  struct DrawRangeException : public Exception {
+    DrawRangeException(const char* file, int line, size_t first, size_t count, size_t size) : Exception(file, line) {
+      m_msg += strfmt("Draw range <%zu, %zu) is out of the buffer of size %zu.", first, first + count, size);
+    }
+  };
+
+  struct VaryingNotFoundException : public Exception {
+    VaryingNotFoundException(const char* file, int line, StrId name) : Exception(file, line) {
+      m_msg += strfmt("Varying with ID = %u isn't declared by the program.", name);
+    }
+  };
 } // namespace swrast
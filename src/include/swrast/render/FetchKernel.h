@@ -0,0 +1,25 @@
+/**
+ * @brief This file contains the kernels fetching vertex attributes for batched vertex shaders.
+ * @author Jakub Kloub, xkloub03, VUT FIT
+ * @file render/FetchKernel.h
+ */
+#pragma once
+#include "state/State.h"
+#include "state/VertexArray.h"
+#include <cstddef>
+#include <cstdint>
+
+namespace swrast {
+  /**
+   * @brief Get fetch kernel for attribute with given number of 32-bit components.
+   *
+   * Kernels copy the components bit-wise, so they work for integer attributes too.
+   * @param components Number of components (1 to 4).
+   * @param gather The samples can be gathered: the data and the stride are multiples of 4 bytes and
+   *        the offsets of all the samples fit into `int32_t`.
+   * @param isa Highest instruction set to use.
+   * @note SSE2 has no gather instruction, so the scalar kernel is used instead.
+   * @return The kernel or nullptr for unsupported number of components.
+   */
+  FetchKernel get_fetch_kernel(uint8_t components, bool gather, SimdIsa isa);
+} // namespace swrast
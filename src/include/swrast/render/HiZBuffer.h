@@ -0,0 +1,69 @@
+/**
+ * @brief This file contains the hierarchical Z-buffer used for occlusion culling.
+ * @author Jakub Kloub, xkloub03, VUT FIT
+ * @file render/HiZBuffer.h
+ */
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+
+namespace swrast {
+  /**
+   * @brief Pyramid of conservative maximum depths of the depth buffer.
+   *
+   * Level 0 holds one value per 8x8 pixel block (the raster blocks) and every next level holds one
+   * value per 8x8 cells of the previous level. Values are never lower than the actual maximum depth
+   * of the region, so anything with depth greater or equal is hidden by the region.
+   *
+   * Depth only decreases between clears (it is written only after passing the depth test), so
+   * concurrent updates of the upper levels from multiple tiles can only leave a value too high,
+   * which is still conservative.
+   */
+  class HiZBuffer {
+  public:
+    /// Width and height of the region covered by one cell in terms of cells of the level below.
+    static constexpr int CELL_SIZE = 8;
+
+    HiZBuffer() = default;
+    /// @param size Size of the depth buffer in pixels.
+    explicit HiZBuffer(glm::uvec2 size);
+
+    /// Check if the buffer has its levels. Default constructed buffer has none and ignores updates.
+    inline bool IsBuilt() const noexcept { return !m_levels.empty(); }
+
+    /// Set all levels to given depth. Call this whenever the depth buffer is cleared.
+    void Clear(float depth);
+
+    /**
+     * @brief Recompute the 8x8 block from the depth buffer and propagate the change upwards.
+     * @param block Top-left pixel of the block (multiple of 8).
+     * @param depth Depth buffer values (row-major, one float per pixel).
+     * @param depth_size Size of the depth buffer. Its width is the row stride, and pixels outside of
+     *        it are skipped.
+     */
+    void UpdateBlock(glm::ivec2 block, const float* depth, glm::uvec2 depth_size);
+
+    /// Get the conservative maximum depth of the 8x8 block with given top-left pixel.
+    float GetBlockDepth(glm::ivec2 block) const;
+
+    /**
+     * @brief Get the conservative maximum depth of the pixels in area <min, max).
+     *
+     * Uses the finest level on which the area spans at most 2x2 cells.
+     */
+    float GetMaxDepth(glm::ivec2 min, glm::ivec2 max) const;
+
+    /// Check if everything in the area <min, max) at depth `depth` or further would fail the depth test.
+    inline bool IsOccluded(glm::ivec2 min, glm::ivec2 max, float depth) const { return depth >= GetMaxDepth(min, max); }
+
+  private:
+    struct Level {
+      glm::uvec2 size;
+      std::vector<float> depth;
+    };
+
+    glm::uvec2 m_size{ 0 };
+    std::vector<Level> m_levels;
+  };
+} // namespace swrast
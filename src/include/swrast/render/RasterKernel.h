@@ -0,0 +1,71 @@
+/**
+ * @brief This file contains the SIMD kernels used during triangle rasterization.
+ * @author Jakub Kloub, xkloub03, VUT FIT
+ * @file render/RasterKernel.h
+ */
+#pragma once
+#include "state/State.h"
+#include <cstdint>
+#include <glm/glm.hpp>
+
+namespace swrast {
+  /// Size of the screen aligned pixel blocks processed by the coverage kernels.
+  constexpr int RASTER_BLOCK = 8;
+
+  /// Edge function of a single triangle edge. Positive values are inside (for CCW triangles).
+  struct EdgeFunc {
+    glm::vec2 v;  ///< Start vertex of the edge.
+    glm::vec2 d;  ///< Edge vector.
+
+    inline float operator()(float px, float py) const { return (py - v.y) * d.x - (px - v.x) * d.y; }
+
+    /// Evaluate the edge function at center of the given pixel.
+    inline float At(int x, int y) const { return (*this)((float)x + 0.5f, (float)y + 0.5f); }
+  };
+
+  /// Number of fractional bits of the fixed point vertex positions.
+  constexpr int SUBPIXEL_BITS = 8;
+  /// Number of fixed point units in one pixel.
+  constexpr int64_t SUBPIXEL_ONE = int64_t(1) << SUBPIXEL_BITS;
+
+  /**
+   * @brief Fixed point edge function in form of a plane equation over the pixel grid.
+   *
+   * The value is exact, so it can be stepped incrementally without any error. Pixel is inside of the
+   * edge if the value is not negative. The fill rule bias is already included in `c`.
+   */
+  struct FixedEdgeFunc {
+    int64_t c;    ///< Value at center of pixel (0, 0).
+    int64_t dx;   ///< Change of the value when moving one pixel in x direction.
+    int64_t dy;   ///< Change of the value when moving one pixel in y direction.
+
+    /// Evaluate the edge function at center of the given pixel.
+    inline int64_t At(int x, int y) const { return c + dx * x + dy * y; }
+  };
+
+  /**
+   * @brief Compute coverage of a 8x8 block of pixels.
+   * @param edges Edge functions of the triangle.
+   * @param block Position of the top-left pixel of the block.
+   * @return Mask with bit `y * 8 + x` set if pixel `block + (x, y)` is inside all edges.
+   */
+  using CoverageKernel = uint64_t (*)(const EdgeFunc (&edges)[3], glm::ivec2 block);
+  /// Same as CoverageKernel, but for fixed point edge functions.
+  using FixedCoverageKernel = uint64_t (*)(const FixedEdgeFunc (&edges)[3], glm::ivec2 block);
+
+  /// Get the best instruction set supported by the CPU we are running on.
+  SimdIsa detect_simd_isa();
+  const char* to_string(SimdIsa isa);
+
+  /**
+   * @brief Get coverage kernel implemented with given instruction set.
+   * @note All kernels produce exactly the same masks as the scalar one.
+   */
+  CoverageKernel get_coverage_kernel(SimdIsa isa);
+
+  /**
+   * @brief Get fixed point coverage kernel implemented with given instruction set.
+   * @note SSE2 lacks 64-bit integer comparison, so the scalar kernel is used instead.
+   */
+  FixedCoverageKernel get_fixed_coverage_kernel(SimdIsa isa);
+} // namespace swrast
@@ -6,33 +6,143 @@
 #pragma once
 #include <array>
 #include <functional>
+#include <memory>
+#include <vector>
 #include <glm/glm.hpp>
 #include "state/Program.h"
 
 namespace swrast {
-  struct InOutVar;
+  /// Rectangle of pixels in screen space. The `max` corner is exclusive.
+  struct ScreenRect {
+    glm::ivec2 min;
+    glm::ivec2 max;
+  };
+
+  /**
+   * @brief Group of fragments generated during rasterization.
+   *
+   * Represents up to 8x8 pixels starting at `origin`, which is aligned to 8 pixels (so the 2x2
+   * quads never cross the blocks). Bit `y * 8 + x` of the mask is set, when pixel
+   * `origin + (x, y)` is covered by the primitive.
+   */
+  struct FragmentBlock {
+    glm::ivec2 origin;
+    uint64_t mask;
+    /// Shade the pixels in 2x2 quads. Pixels of lines are shaded alone, without helpers.
+    bool quads = true;
+  };
+
+  /**
+   * @brief Plane equation `c + dx * x + dy * y` of a value which is linear in screen space.
+   * @note The position is relative to the plane origin of the primitive (its first vertex), so the
+   *       values keep their precision even for primitives far from the screen origin.
+   */
+  template<class T>
+  struct PlaneEq {
+    T c{};
+    T dx{};
+    T dy{};
+
+    inline T At(glm::vec2 p) const { return c + dx * p.x + dy * p.y; }
+    /// Evaluate the plane of a float value at positions of all lanes.
+    inline WFloat At(const WFloat& x, const WFloat& y) const { return c + dx * x + dy * y; }
+  };
+
+  /// Interpolation data of a single varying slot.
+  struct VarPlane {
+    bool integer;
+    /// Value of the integer variable (these aren't interpolated).
+    InOutVar flat;
+    /// Plane of the float variable divided by w.
+    PlaneEq<glm::vec4> plane;
+  };
+
+  /**
+   * @brief Set up state of a primitive, which is everything its rasterization needs.
+   *
+   * It holds neither the vertex attributes nor the primitive assembly state, so it is cheap to copy
+   * and the binned primitives are stored by value (see TileBinner). Planes of the varyings are
+   * stored outside of it.
+   */
+  struct RasterPrimitive {
+    using FragFunc = std::function<void(const FragmentBlock&)>;
+
+    enum class Kind : uint8_t { Triangle, Line };
+
+    Kind kind = Kind::Triangle;
+    /// Small triangles have their coverage computed in Setup().
+    bool small = false;
+    /// Covered pixels of the small triangle bounding box.
+    uint8_t small_mask = 0;
+    /// Number of the varying planes.
+    uint8_t var_count = 0;
+    /// Top-left pixel of the small triangle bounding box.
+    glm::ivec2 small_min{ 0 };
+    /// Screen positions and depths of the vertices. Lines use just the first two.
+    std::array<glm::vec3, 3> pos{};
+    /// Screen position the plane equations are relative to.
+    glm::vec2 plane_origin{ 0.0f };
+    /// Depth of the fragments. This is linear in screen space, so it needs no perspective correction.
+    PlaneEq<float> depth_plane;
+    /// 1/w of the fragments used for perspective correct interpolation.
+    PlaneEq<float> inv_w_plane;
+    /// Planes of the varyings, indexed by the varying slot.
+    const VarPlane* var_planes = nullptr;
+
+    /**
+     * @brief Generate fragments of the primitive.
+     * @param func Function called for each generated group of fragments.
+     * @param rect Only fragments inside of this rectangle are generated.
+     * @note This doesn't modify the primitive, so it is safe to rasterize the same primitive
+     *       from multiple threads as long as the rectangles don't overlap.
+     */
+    void Rasterize(const FragFunc& func, const ScreenRect& rect) const;
+    /**
+     * @brief Interpolate the vertex shader outputs and depth at all lanes of the batch.
+     *
+     * Reads x and y of FragmentBatch::m_FragCoord, writes its z and the batch inputs.
+     */
+    void Interpolate(FragmentBatch& batch) const;
+    /// Interpolate only depth of the fragments at given screen positions.
+    inline WFloat InterpolateDepth(const WVec4& pos) const {
+      return depth_plane.At(pos[0] - plane_origin.x, pos[1] - plane_origin.y);
+    }
+  };
 
   class RenderPrimitive {
   public:
     using PrimFunc = std::function<void(RenderPrimitive*)>;
-    using FragFunc = std::function<void(glm::vec4)>;
+    using FragFunc = RasterPrimitive::FragFunc;
     /// Function called each time a new primitive is constructed.
     PrimFunc m_OnEmit = [](auto){};
 
     virtual ~RenderPrimitive() {}
 
-    virtual void ProcessVertex(glm::vec4& position) = 0;
+    /**
+     * @brief Add shaded vertex to the primitive. Emits the primitive once it has all its vertices.
+     * @param position Output position of the vertex shader.
+     * @param vars Output variables of the vertex shader.
+     */
+    virtual void ProcessVertex(const glm::vec4& position, const Shader::InOutVars& vars) = 0;
     virtual void Clip(const PrimFunc& func) = 0;
     virtual void PerpDiv() = 0;
     virtual void NdcTransform() = 0;
     virtual bool Cull() = 0;
-    void Rasterize(const FragFunc& func) {
-      if (State::m_WriteFrame)
-        wireframe(func);
-      else
-        rasterize(func);
-    }
-    virtual void Interpolate(glm::vec4& pos, Shader::InOutVars& vars) = 0;
+    /**
+     * @brief Compute the plane equations used during interpolation.
+     *
+     * This is done once per primitive after it passes culling, so the per fragment interpolation
+     * is just evaluation of the planes and a single reciprocal for perspective correction.
+     * @return False if the primitive generates no fragments and can be dropped.
+     */
+    virtual bool Setup() = 0;
+    /**
+     * @brief Get the state needed for rasterization. Valid only after Setup().
+     * @note The varying planes are owned by this primitive, so they change with the next Setup().
+     */
+    inline const RasterPrimitive& GetRaster() const noexcept { return m_raster; }
+    /// Get screen space bounding rectangle of the primitive. Valid only after NdcTransform().
+    virtual ScreenRect GetBounds() const = 0;
 
     /**
      * @brief Set specific primitive.
@@ -46,9 +156,10 @@ namespace swrast {
     /// Reset the vertex emitting state.
     virtual void Reset() {};
   protected:
-
-    virtual void rasterize(const FragFunc& func) = 0;
-    virtual void wireframe(const FragFunc& func) = 0;
+    /// Set up state filled by Setup().
+    RasterPrimitive m_raster;
+    /// Planes of the varyings referenced by m_raster.
+    std::array<VarPlane, MAX_VARYINGS> m_varPlanes;
   };
 
   /// Struct represeting a single vertex in a primitie.
@@ -60,7 +171,6 @@ namespace swrast {
   };
 
   class TrianglePrimitive : public RenderPrimitive {
-    float m_invArea;
     unsigned m_currentVertex = 0;
     Primitive m_prim;
     std::array<glm::vec4, 2> m_posBackup;
@@ -76,27 +186,23 @@ namespace swrast {
     Shader::InOutVars& c_attr = m_Vertices[2].vars;
 
     TrianglePrimitive(const std::array<Vertex, 3>& vertices);
+    TrianglePrimitive(const TrianglePrimitive& other);
     TrianglePrimitive() = default;
 
-    void ProcessVertex(glm::vec4& position) override;
+    void ProcessVertex(const glm::vec4& position, const Shader::InOutVars& vars) override;
     void Clip(const PrimFunc& fun) override;
     void PerpDiv() override;
     void NdcTransform() override;
     bool Cull() override;
-    void Interpolate(glm::vec4& pos, Shader::InOutVars& vars) override;
+    bool Setup() override;
+    ScreenRect GetBounds() const override;
     void SetPrimitive(Primitive prim) override;
     void Reset() override;
-
-  protected:
-    void rasterize(const FragFunc& func) override;
-    void wireframe(const FragFunc& func) override;
   };
 
   class LinePrimitive : public RenderPrimitive {
     /// Current processed vertex. This is used during ProcessVertex.
     unsigned m_currentVertex = 0;
-    /// Vector from a to b used during interpolation.
-    glm::vec2 m_ab;
     Primitive m_prim;
   public:
     std::array<Vertex, 2> m_Vertices;
@@ -106,20 +212,18 @@ namespace swrast {
     Shader::InOutVars& b_attr = m_Vertices[1].vars;
 
     LinePrimitive(const std::array<Vertex, 2>& vertices);
+    LinePrimitive(const LinePrimitive& other);
     LinePrimitive() = default;
 
-    void ProcessVertex(glm::vec4& position) override;
+    void ProcessVertex(const glm::vec4& position, const Shader::InOutVars& vars) override;
     void Clip(const PrimFunc& fun) override;
     void PerpDiv() override;
     void NdcTransform() override;
     bool Cull() override;
-    void Interpolate(glm::vec4& pos, Shader::InOutVars& vars) override;
+    bool Setup() override;
+    ScreenRect GetBounds() const override;
     void SetPrimitive(Primitive prim) override;
     void Reset() override;
-
-  protected:
-    void rasterize(const FragFunc& func) override;
-    void wireframe(const FragFunc& func) override;
   };
 } // namespace swrast
 
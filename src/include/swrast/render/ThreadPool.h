@@ -0,0 +1,61 @@
+/**
+ * @brief This file contains a simple pool of worker threads used by the renderer.
+ * @author Jakub Kloub, xkloub03, VUT FIT
+ * @file render/ThreadPool.h
+ */
+#pragma once
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace swrast {
+  /**
+   * @brief Fixed-size pool of worker threads.
+   *
+   * The pool is not a general task queue. Each call to Run() hands the same task to every worker
+   * and blocks until all of them return. Tasks are expected to distribute the work among themselves
+   * (for example by pulling job indices from an atomic counter).
+   */
+  class ThreadPool {
+  public:
+    /// Task executed by every worker. The argument is index of the worker in range <0, Size()).
+    using Task = std::function<void(uint32_t)>;
+
+    /**
+     * @brief Create the pool and start the worker threads.
+     * @param worker_count Number of workers to start. If 0, then hardware concurrency is used.
+     */
+    explicit ThreadPool(uint32_t worker_count);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    /**
+     * @brief Execute the task on all workers and wait for them to finish.
+     * @param task Task to execute.
+     * @note If any of the workers throws, then the first exception is rethrown from here.
+     */
+    void Run(const Task& task);
+
+    /// Get number of worker threads.
+    inline uint32_t Size() const noexcept { return m_threads.size(); }
+
+  private:
+    std::vector<std::thread> m_threads;
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::condition_variable m_done;
+    const Task* m_task = nullptr;
+    uint64_t m_generation = 0;
+    uint32_t m_pending = 0;
+    bool m_stop = false;
+    std::exception_ptr m_error;
+
+    void workerLoop(uint32_t index);
+  };
+} // namespace swrast
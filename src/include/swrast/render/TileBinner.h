@@ -0,0 +1,74 @@
+/**
+ * @brief This file contains the sort-middle tile binning used by the tiled render backend.
+ * @author Jakub Kloub, xkloub03, VUT FIT
+ * @file render/TileBinner.h
+ */
+#pragma once
+#include "render/RenderPrimitive.h"
+#include "render/ThreadPool.h"
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace swrast {
+  /**
+   * @brief Sorts set up primitives into screen tiles and rasterizes the tiles in parallel.
+   *
+   * Primitives are stored in the order they were binned and every tile keeps indices of the
+   * primitives overlapping it in that same order. Because no two tiles share a pixel, workers can
+   * process different tiles at the same time while each pixel still sees the primitives in
+   * submission order. Depth testing and blending thus give the same result as serial rendering.
+   *
+   * Only the set up state of the primitives (RasterPrimitive) is stored, by value in vectors which
+   * keep their capacity between the flushes, so binning doesn't allocate per primitive.
+   */
+  class TileBinner {
+  public:
+    /**
+     * @brief Function called for every primitive overlapping a tile.
+     * @param prim Primitive to rasterize.
+     * @param tile Pixels covered by the tile (clipped to the framebuffer).
+     * @param worker Index of the worker thread processing the tile.
+     */
+    using TileFunc = std::function<void(const RasterPrimitive* prim, const ScreenRect& tile, uint32_t worker)>;
+
+    /// @param tile_size Width and height of the tiles in pixels.
+    explicit TileBinner(uint32_t tile_size);
+
+    /**
+     * @brief Prepare the tile grid for given framebuffer.
+     * @param fb_size Size of the framebuffer being rendered into.
+     * @note Any binned primitives are dropped.
+     */
+    void Begin(glm::uvec2 fb_size);
+
+    /**
+     * @brief Store the set up state of the primitive into all tiles it overlaps.
+     * @param prim Primitive after Setup().
+     */
+    void Bin(const RenderPrimitive& prim);
+
+    /**
+     * @brief Rasterize all binned primitives and drop them afterwards.
+     * @param pool Workers which process the tiles.
+     * @param func Function called for every primitive in every tile.
+     */
+    void Flush(ThreadPool& pool, const TileFunc& func);
+
+    /// Get number of currently binned primitives.
+    inline size_t Size() const noexcept { return m_prims.size(); }
+
+  private:
+    uint32_t m_tileSize;
+    glm::uvec2 m_fbSize{ 0 };
+    glm::uvec2 m_tileCount{ 0 };
+    std::vector<RasterPrimitive> m_prims;
+    /// Varying planes of all the binned primitives. Pointers of the primitives are set in Flush(),
+    /// because the vector may still grow during binning.
+    std::vector<VarPlane> m_varPlanes;
+    /// Offset of the varying planes of each primitive in m_varPlanes.
+    std::vector<uint32_t> m_varOffsets;
+    /// Indices into m_prims for every tile (row-major).
+    std::vector<std::vector<uint32_t>> m_bins;
+  };
+} // namespace swrast
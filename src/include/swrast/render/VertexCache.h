@@ -0,0 +1,121 @@
+/**
+ * @brief This file contains the post-transform vertex cache used by indexed draws.
+ * @author Jakub Kloub, xkloub03, VUT FIT
+ * @file render/VertexCache.h
+ */
+#pragma once
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <glm/glm.hpp>
+#include <vector>
+#include "state/Program.h"
+
+namespace swrast {
+  /**
+   * @brief FIFO cache of the last shaded vertices of an indexed draw.
+   *
+   * Indices are pushed in draw order. Vertices missing in the cache are collected into a batch and
+   * shaded together, then all the pushed vertices are emitted in the original order. So a vertex
+   * shared by neighbouring primitives is shaded just once.
+   *
+   * Entries are found through a small hash table indexed by a hash of the vertex index.
+   * Colliding indices just overwrite each other, which can only turn a hit into a miss.
+   *
+   * Between the lookup of a vertex and its emission at most WIDE_LANES new vertices enter the
+   * cache. Entries that close to eviction are treated as misses, so emitted entries are always valid.
+   *
+   * Which vertices are shaded and emitted depends only on the indices. So for instanced draws the
+   * cache records these steps for the first instance and the other instances just replay them.
+   */
+  class VertexCache {
+  public:
+    /// Number of cached vertices.
+    static constexpr uint8_t SIZE = 32;
+    /// Maximum number of vertices pushed, but not emitted yet.
+    static constexpr uint8_t QUEUE_SIZE = 64;
+    /// Number of hash table buckets.
+    static constexpr uint32_t BUCKET_BITS = 7;
+    static constexpr uint32_t BUCKETS = 1 << BUCKET_BITS;
+
+    /// Function receiving the shaded vertices in draw order.
+    using EmitFunc = std::function<void(const glm::vec4& position, const Shader::InOutVars& vars)>;
+
+    /**
+     * @brief Start a new draw. The cache is emptied, because the vertex outputs depend on the draw state.
+     * @param shader Vertex shader of the draw.
+     * @param ctx Context to execute the shader in.
+     * @param emit Function receiving the shaded vertices.
+     * @param record Record the shading steps, so they can be replayed.
+     */
+    void Begin(const VertexShader* shader, VertexContext* ctx, EmitFunc emit, bool record = false);
+    /// Add vertex with given index to the draw.
+    void Push(uint32_t index);
+    /// Shade the pending vertices and emit all pushed vertices. Call this at the end of the draw.
+    void Flush();
+
+    /// Number of recorded steps. Taken after Flush(), it marks the end of the pushed indices.
+    inline size_t GetStepCount() const noexcept { return m_steps.size(); }
+    /**
+     * @brief Shade and emit the vertices again as the recorded steps did.
+     *
+     * The shader is executed with the current state of the context (e.g. another instance).
+     * @param begin First step to replay.
+     * @param end Step after the last replayed one.
+     */
+    void Replay(size_t begin, size_t end);
+
+    /// Number of vertices shaded since Begin().
+    inline uint64_t GetShadedCount() const noexcept { return m_shaded; }
+
+  private:
+    /// Tag of an empty entry.
+    static constexpr uint32_t NO_INDEX = UINT32_MAX;
+
+    /// Shading of a batch followed by emission of the queued entries.
+    struct Step {
+      std::array<uint32_t, WIDE_LANES> vertex_ids;
+      std::array<uint8_t, WIDE_LANES> entries;
+      uint8_t count;
+      uint8_t queued;
+      /// Index of the first emitted entry in m_stepQueue.
+      uint32_t first_queued;
+    };
+
+    const VertexShader* m_shader = nullptr;
+    VertexContext* m_ctx = nullptr;
+    EmitFunc m_emit;
+    uint64_t m_shaded = 0;
+
+    /// Entry of the last vertex hashed into each bucket.
+    std::array<uint8_t, BUCKETS> m_buckets;
+    /// Vertex index of each entry.
+    std::array<uint32_t, SIZE> m_tags;
+    std::array<glm::vec4, SIZE> m_positions;
+    std::array<Shader::InOutVars, SIZE> m_vars;
+    /// Entry replaced by the next miss.
+    uint8_t m_head = 0;
+
+    /// Entries of the pushed vertices in draw order.
+    std::array<uint8_t, QUEUE_SIZE> m_queue;
+    uint8_t m_queued = 0;
+
+    /// Vertices waiting to be shaded and their entries.
+    VertexBatch m_batch;
+    std::array<uint8_t, WIDE_LANES> m_batchEntries;
+
+    bool m_record = false;
+    std::vector<Step> m_steps;
+    /// Emitted entries of all the steps.
+    std::vector<uint8_t> m_stepQueue;
+
+    /// Get bucket of the vertex index. Multiplicative hash spreads regular index patterns (e.g. grid rows).
+    static inline uint32_t bucket(uint32_t index) { return (index * 2654435761u) >> (32 - BUCKET_BITS); }
+    /// Find entry holding the vertex, which won't be evicted before the next flush.
+    int lookup(uint32_t index);
+    /// Shade the pending vertices and store them into their entries.
+    void shade();
+    /// Emit the vertices of the entries.
+    void emit(const uint8_t* entries, uint8_t count);
+  };
+} // namespace swrast
@@ -0,0 +1,53 @@
+/**
+ * @brief This file contains the parallel vertex shading stage.
+ * @author Jakub Kloub, xkloub03, VUT FIT
+ * @file render/VertexStage.h
+ */
+#pragma once
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <vector>
+#include "state/Program.h"
+
+namespace swrast {
+  class ThreadPool;
+
+  /**
+   * @brief Shades a range of vertices on all workers into a post-transform buffer.
+   *
+   * The range is split into chunks, which the workers shade in batches. Primitive assembly then
+   * reads the transformed vertices from the buffer, so shading isn't interleaved with assembly.
+   * Varyings are stored packed (just the used slots), so the buffer stays small.
+   */
+  class VertexStage {
+  public:
+    /// Number of vertices shaded by a worker at once.
+    static constexpr uint32_t CHUNK_SIZE = 1024;
+    /// Smaller ranges aren't worth waking the workers up.
+    static constexpr uint32_t MIN_VERTICES = 4 * CHUNK_SIZE;
+
+    /**
+     * @brief Shade vertices with IDs in range <first, first + count).
+     * @param shader Vertex shader of the draw.
+     * @param contexts Bound contexts, one per worker.
+     */
+    void Shade(ThreadPool& workers, const VertexShader* shader, std::vector<VertexContext>& contexts,
+               uint32_t first, uint32_t count);
+
+    /// Get the shaded vertex. It has to be in the last shaded range.
+    inline void Fetch(uint32_t vertex_id, glm::vec4& position, Shader::InOutVars& vars) const {
+      size_t i = vertex_id - m_first;
+      position = m_positions[i];
+      const glm::vec4* v = m_vars.data() + i * m_varyings;
+      for (uint8_t j = 0; j < m_varyings; j++)
+        vars[j].f4 = v[j];
+    }
+
+  private:
+    uint32_t m_first = 0;
+    /// Number of varyings stored per vertex.
+    uint8_t m_varyings = 0;
+    std::vector<glm::vec4> m_positions;
+    std::vector<glm::vec4> m_vars;
+  };
+} // namespace swrast
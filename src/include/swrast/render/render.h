@@ -4,9 +4,13 @@
  * @file render/render.h
  */
 #pragma once
+#include "state/Program.h"
 #include "state/State.h"
+#include <atomic>
 #include <cstddef>
 #include <cstdint>
+#include <span>
+#include <vector>
 
 namespace swrast {
   /// Represents the basic primitives used during rendering.
@@ -32,10 +36,14 @@ namespace swrast {
   struct RenderCommand {
     Primitive draw_primitive;
     bool is_indexed;
-    size_t count;
-    size_t offset;
+    /// Draws executed with the same state. They share the per draw setup.
+    std::span<const DrawRecord> draws;
+    /// Number of times all the draws are executed. See VertexContext::m_InstanceId.
+    uint32_t instance_count = 1;
   };
 
+  class HiZBuffer;
+
   struct RenderContext {
     RenderCommand cmd;
     ObjectHandle<Program> prg;
@@ -43,11 +51,72 @@ namespace swrast {
     ObjectHandle<Framebuffer> fb;
     CullFace cull;
     bool depth;
+    RasterMode raster;
+    float guard_band;
+    bool small_triangles;
+    /// Hierarchical Z-buffer updated after depth writes. Null when depth isn't tested or there is no depth buffer.
+    HiZBuffer* hiz;
+    /// Whether primitives and blocks can be rejected using `hiz` (their depth comes from interpolation).
+    bool occlusion_cull;
+    /// Whether the restart index ends the primitive in indexed draws.
+    bool primitive_restart;
+  };
+
+  /// Counters collected during the last draw call.
+  struct RenderStats {
+    uint64_t indices_processed = 0;   ///< Vertices submitted by the draw (one per index for indexed draws).
+    uint64_t vertices_shaded = 0;     ///< Vertex shader runs. Lower than `indices_processed` thanks to the vertex cache or vertex stage.
+    uint64_t primitives_rejected = 0; ///< Primitives completely outside of the view frustum.
+    uint64_t primitives_clipped = 0;  ///< Triangles crossing the guard band, which needed polygon clipping.
+    uint64_t small_triangles = 0;     ///< Triangles rasterized by testing the few pixels of their bounding box directly.
+    uint64_t primitives_occluded = 0; ///< Triangles completely behind the depth buffer contents according to the Hi-Z buffer.
+    uint64_t blocks_rejected = 0;   ///< 8x8 raster blocks skipped without testing any pixel.
+    uint64_t blocks_accepted = 0;   ///< 8x8 raster blocks fully inside a triangle, emitted without per-pixel tests.
+    uint64_t blocks_partial = 0;    ///< 8x8 raster blocks which needed per-pixel coverage (computed by SIMD kernel).
+    uint64_t blocks_occluded = 0;   ///< 8x8 raster blocks touched by a triangle, but completely hidden according to the Hi-Z buffer.
+    uint64_t fragments_shaded = 0;  ///< Covered fragments for which the fragment shader was executed.
+    uint64_t fragments_early_killed = 0;  ///< Covered fragments which failed early depth test, so they weren't shaded.
+    uint64_t fragments_discarded = 0;  ///< Shaded fragments discarded by the fragment shader.
+    uint64_t helper_invocations = 0;  ///< Fragment shader runs on uncovered pixels of 2x2 quads (only for derivatives).
+
+    /// Add to one of the counters. This is safe to call from multiple threads.
+    static void Add(uint64_t& counter, uint64_t value) {
+      std::atomic_ref<uint64_t>(counter).fetch_add(value, std::memory_order_relaxed);
+    }
   };
 
+  class ThreadPool;
+  class TileBinner;
+  class VertexCache;
+  class VertexStage;
+
   class RenderState {
   public:
     inline static RenderContext ctx{};
+    /// Statistics of the last draw call.
+    inline static RenderStats stats{};
+    /// Instruction set used by the SIMD kernels.
+    inline static SimdIsa isa = SimdIsa::Scalar;
+    /// Worker threads used by the tiled backend. Empty when using serial backend.
+    inline static Ref<ThreadPool> workers{};
+    /// Primitive binning used by the tiled backend. Empty when using serial backend.
+    inline static Ref<TileBinner> binner{};
+    /// Post-transform cache of indexed draws.
+    inline static Ref<VertexCache> vertex_cache{};
+    /// Parallel vertex shading of large draws. Empty when using serial backend.
+    inline static Ref<VertexStage> vertex_stage{};
+    /// Vertex shader invocation contexts, one per worker (a single one for the serial backend).
+    inline static std::vector<VertexContext> vs_contexts{};
+    /// Fragment shader invocation contexts, one per worker (a single one for the serial backend).
+    inline static std::vector<FragmentContext> fs_contexts{};
+
+    /**
+     * @brief Set up the render backend.
+     * @param spec Backend configuration.
+     */
+    static void Init(const StateSpec& spec);
+    /// Stop the worker threads and free backend resources.
+    static void Destroy();
     static void Draw(const RenderCommand& render_command);
   };
 } // namespace swrast
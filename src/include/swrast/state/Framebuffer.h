@@ -6,6 +6,7 @@
 #pragma once
 #include "state/State.h"
 #include "state/Texture.h"
+#include "render/HiZBuffer.h"
 #include <atomic>
 #include <glm/glm.hpp>
 
@@ -45,6 +46,7 @@ namespace swrast {
      * @param color Color to clear all the color attachments with.
      * @param depth Flag signiffying if the depth should be clear too.
      * @note If you don't want to clear color buffer, then set the `color` argument to {}
+     * @note Depth is cleared to 1.0 (the far plane), stored as float in the depth buffer.
      */
     Framebuffer& Clear(Opt<Color> color, bool depth = true);
 
@@ -56,11 +58,19 @@ namespace swrast {
 
     inline Opt<ObjectHandle<Texture>> GetDepthBuffer() const { return m_depthBuffer; }
     Opt<ObjectHandle<Texture>> GetColorAttach(uint32_t index) const;
+
+    /**
+     * @brief Get the hierarchical Z-buffer of the depth buffer.
+     * @note It is kept up to date by rendering and Clear(). When the depth buffer is written in
+     *       some other way, the depth must be cleared before rendering with depth test again.
+     */
+    inline HiZBuffer& GetHiZ() { return m_hiZ; }
   private:
     FramebufferState m_state;
     glm::uvec2 m_size;
     Opt<ObjectHandle<Texture>> m_depthBuffer;
     std::vector<ObjectHandle<Texture>> m_colorAtts;
+    HiZBuffer m_hiZ;
   };
 
   template<>
@@ -5,18 +5,86 @@
  */
 #pragma once
 #include <glm/glm.hpp>
+#include <limits>
+#include <span>
+#include <type_traits>
+#include <variant>
 #include <vector>
 #include "state/State.h"
 #include "swrast_private.h"
 
 namespace swrast {
+  /// Type of the indices stored in an IndexBuffer.
+  enum class IndexType : uint8_t {
+    UInt8 = 0, UInt16, UInt32,
+  };
+
+  /// Get the smallest index type which can hold given index.
+  IndexType smallest_index_type(uint32_t max_index);
+
+  /// Index value restarting the primitive for indices of type T. See State::m_PrimitiveRestart.
+  template<class T>
+  constexpr T restart_index() { return std::numeric_limits<T>::max(); }
+  /// Index value restarting the primitive for given index type.
+  uint32_t restart_index(IndexType type);
+
+  /**
+   * @brief Buffer of vertex indices.
+   *
+   * Indices are stored as 8, 16 or 32-bit unsigned integers, so meshes with few vertices take less
+   * memory and bandwidth. The type is chosen when the buffer is created or by Compact().
+   */
   class IndexBuffer : public UniqueId<IndexBuffer> {
   public:
     using Data = std::vector<uint32_t>;
-    Data data;
 
-    IndexBuffer(const Data&& data) : data(data) {}
-    IndexBuffer() : data() {}
+    IndexBuffer(const Data&& data) : m_data(data) { updateMaxIndex(); }
+    /// Create buffer of 8 or 16-bit indices.
+    template<class T> requires std::is_same_v<T, uint8_t> || std::is_same_v<T, uint16_t>
+    IndexBuffer(std::vector<T>&& data) : m_data(std::move(data)) { updateMaxIndex(); }
+    IndexBuffer() : m_data(Data()) {}
+
+    inline IndexType GetType() const noexcept { return IndexType(m_data.index()); }
+    /// Get number of the indices.
+    inline size_t Size() const noexcept { return std::visit([](const auto& v){ return v.size(); }, m_data); }
+    /**
+     * @brief Get the largest stored index (0 for empty buffer).
+     *
+     * The value is computed when the indices change, so this doesn't read the indices.
+     * @param primitive_restart Skip the restart indices.
+     */
+    inline uint32_t MaxIndex(bool primitive_restart = false) const noexcept {
+      return primitive_restart ? m_maxIndexRestart : m_maxIndex;
+    }
+
+    /**
+     * @brief Call the function with span of the indices of their actual type.
+     *
+     * The function is instantiated for each index type, so loops over the indices are specialized.
+     */
+    template<class Func>
+    inline decltype(auto) Visit(Func&& func) const {
+      return std::visit([&](const auto& v){ return func(std::span(v)); }, m_data);
+    }
+
+    /**
+     * @brief Narrow the indices to the smallest type which can hold all of them.
+     * @param primitive_restart Keep the restart indices, so they become the restart index of the
+     *        new type. The other indices then have to be smaller than it.
+     * @return The new index type.
+     */
+    IndexType Compact(bool primitive_restart = false);
+
+  private:
+    /// Alternatives are in the order of IndexType.
+    std::variant<std::vector<uint8_t>, std::vector<uint16_t>, Data> m_data;
+    /// Largest index.
+    uint32_t m_maxIndex = 0;
+    /// Largest index which isn't the restart index.
+    uint32_t m_maxIndexRestart = 0;
+
+    /// Recompute the largest indices. Called whenever the indices change.
+    void updateMaxIndex();
   };
 
   template<>
@@ -0,0 +1,32 @@
+/**
+ * @file state/IndirectBuffer.h
+ * @brief This file contains declaration of indirect draw buffer.
+ * @author Jakub Kloub, xkloub03, VUT FIT
+ */
+#pragma once
+#include <vector>
+#include "state/State.h"
+#include "swrast_private.h"
+
+namespace swrast {
+  /**
+   * @brief Buffer of draw records executed by a single State::MultiDrawIndexedIndirect() call.
+   *
+   * This lets the draw list be built once (e.g. for all meshes packed into one vertex and index
+   * buffer) and then submitted every frame.
+   */
+  class IndirectBuffer : public UniqueId<IndirectBuffer> {
+  public:
+    using Data = std::vector<DrawRecord>;
+    Data data;
+
+    IndirectBuffer(const Data&& data) : data(data) {}
+    IndirectBuffer() : data() {}
+  };
+
+  template<>
+  OptRef<IndirectBuffer> State::GetObject(ObjectId id);
+
+  template<>
+  ObjectHandle<IndirectBuffer> State::CreateObject(IndirectBuffer&& buf);
+} // namespace swrast
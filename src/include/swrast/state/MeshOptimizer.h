@@ -0,0 +1,110 @@
+/**
+ * @file state/MeshOptimizer.h
+ * @brief This file contains the offline optimizer of index and vertex buffer contents.
+ * @author Jakub Kloub, xkloub03, VUT FIT
+ */
+#pragma once
+#include <cstdint>
+#include "state/IndexBuffer.h"
+#include "state/VertexBuffer.h"
+
+namespace swrast {
+  /// Quality metrics of a triangle mesh. See MeshOptimizer::Analyze().
+  struct MeshStats {
+    float acmr = 0.0f;       ///< Average cache miss ratio: shaded vertices per triangle (0.5 at best, 3 at worst).
+    float atvr = 0.0f;       ///< Average transformed vertex ratio: shaded vertices per referenced vertex (1 at best).
+    float overdraw = 0.0f;   ///< Fragments passing the depth test per covered pixel, averaged over 6 view directions (1 at best).
+    float overfetch = 0.0f;  ///< Bytes of the vertex buffer read per byte of the vertex data (1 at best).
+  };
+
+  /// Metrics of the mesh before and after an optimization step.
+  struct MeshOptimizeReport {
+    MeshStats before;
+    MeshStats after;
+  };
+
+  /**
+   * @brief Reorders triangle list indices and vertex data of a mesh for faster rendering.
+   *
+   * The steps are meant to be run offline in this order:
+   *  1. OptimizeVertexCache() for post-transform vertex cache hits,
+   *  2. OptimizeOverdraw() to reduce overdraw without losing much of the cache efficiency,
+   *  3. OptimizeVertexFetch() to store the vertices in the order they are used.
+   *
+   * The rendered image doesn't change (up to the order of equal depth fragments), only the triangle
+   * and vertex orders do. The optimized data are then moved into IndexBuffer and VertexBuffer.
+   */
+  class MeshOptimizer {
+  public:
+    /// Size of the simulated vertex cache. The renderer's cache has 32 entries, but the entries
+    /// which could be evicted before the next flush are missed, so it behaves as a FIFO of 24.
+    static constexpr uint32_t CACHE_SIZE = 24;
+    /// Strips are extended only by triangles this close to their first triangle in the list order.
+    /// Longer strips would leave the cache optimized order and shade more vertices.
+    static constexpr uint32_t STRIP_WINDOW = 32;
+
+    /// Triangle list indices.
+    IndexBuffer::Data indices;
+    /// Interleaved vertex data.
+    VertexBuffer::Data vertices;
+
+    /**
+     * @param vertex_stride Number of floats per vertex.
+     * @param position_offset Offset of the vec3 position in floats from the start of a vertex.
+     */
+    MeshOptimizer(IndexBuffer::Data&& indices, VertexBuffer::Data&& vertices, uint32_t vertex_stride,
+                  uint32_t position_offset = 0);
+
+    /// Measure the quality metrics of the current mesh.
+    MeshStats Analyze() const;
+
+    /**
+     * @brief Reorder the triangles, so vertices are reused from the cache as much as possible.
+     *
+     * Uses the linear-speed algorithm of Tom Forsyth: triangles are emitted greedily by score of
+     * their vertices, which prefers recently used vertices and vertices with few remaining triangles.
+     */
+    MeshOptimizeReport OptimizeVertexCache();
+
+    /**
+     * @brief Reorder clusters of triangles, so the ones likely to occlude others are drawn first.
+     *
+     * The cache optimized order is split into clusters where the cache restarts, which are further
+     * split as long as their ACMR stays below `threshold` times the ACMR of the whole cluster. The
+     * clusters are then sorted by how much they face away from the center of the mesh, which is
+     * a view independent estimate of being in front of the rest of the mesh.
+     * @param threshold Allowed growth of ACMR. Higher values produce more clusters.
+     */
+    MeshOptimizeReport OptimizeOverdraw(float threshold = 1.05f);
+
+    /**
+     * @brief Store the vertices in the order of their first use and remap the indices.
+     *
+     * Vertices not referenced by any triangle are removed.
+     */
+    MeshOptimizeReport OptimizeVertexFetch();
+
+    /**
+     * @brief Convert the triangle list into triangle strips separated by restart indices.
+     *
+     * Each strip starts at the first unused triangle and is greedily extended by its neighbours
+     * within STRIP_WINDOW, so the vertex cache efficiency of an optimized mesh carries over. The
+     * result is drawn as Primitive::TriangleStrip with State::m_PrimitiveRestart enabled and keeps
+     * the winding of the triangles. Degenerate triangles are dropped, as they don't cover any pixel.
+     * @return Strip indices separated by `restart_index<uint32_t>()`. The mesh isn't changed.
+     */
+    IndexBuffer::Data Stripify() const;
+
+  private:
+    uint32_t m_stride;
+    uint32_t m_positionOffset;
+
+    inline uint32_t vertexCount() const { return vertices.size() / m_stride; }
+    inline glm::vec3 position(uint32_t vertex) const {
+      const float* p = vertices.data() + (size_t)vertex * m_stride + m_positionOffset;
+      return { p[0], p[1], p[2] };
+    }
+    /// Overdraw averaged over the views along the positive and negative axes.
+    float measureOverdraw() const;
+  };
+} // namespace swrast
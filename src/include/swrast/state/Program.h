@@ -6,47 +6,194 @@
 #pragma once
 #include "error.hpp"
 #include "state/State.h"
+#include "state/UniformBuffer.h"
+#include "state/VertexArray.h"
 #include "swrast_private.h"
 #include "utils.h"
+#include "wide.h"
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <array>
+#include <atomic>
 #include <functional>
 #include <any>
+#include <mutex>
+#include <type_traits>
+#include <vector>
 
 namespace swrast {
   using Uniform = std::any;
   using UniformGroup = std::unordered_map<StrId, Uniform>;
 
+  /// Maximum number of uniform blocks bound to a program.
+  constexpr uint8_t MAX_UNIFORM_BLOCKS = 8;
+  /// Uniform blocks bound to a program, indexed by the binding point.
+  using UniformBlocks = std::array<ObjectHandle<UniformBuffer>, MAX_UNIFORM_BLOCKS>;
+
   enum class ShaderType { Vertex, Fragment };
 
-  struct InOutVar {
-    union {
-      int32_t i1;
-      glm::ivec2 i2;
-      glm::ivec3 i3;
-      glm::ivec4 i4;
-      float f1;
-      glm::vec2 f2;
-      glm::vec3 f3;
-      glm::vec4 f4;
-    };
-    /// Flag that tells is if this is a integer type. We use this during interpolation (integer types aren't interpolated).
-    bool integer;
+  /// Maximum number of varyings passed from the vertex shader to the fragment shader.
+  constexpr uint8_t MAX_VARYINGS = 16;
+
+  /// Value of a single varying. Each varying takes the same space, no matter its type.
+  union InOutVar {
+    int32_t i1;
+    glm::ivec2 i2;
+    glm::ivec3 i3;
+    glm::ivec4 i4;
+    float f1;
+    glm::vec2 f2;
+    glm::vec3 f3;
+    glm::vec4 f4;
+  };
+
+  /// Types of the varyings.
+  enum class VaryingType : uint8_t {
+    Int, IVec2, IVec3, IVec4,
+    Float, Vec2, Vec3, Vec4,
+  };
+  /// Integer varyings aren't interpolated, they are taken from the first vertex of the primitive.
+  inline bool is_integer(VaryingType type) { return type <= VaryingType::IVec4; }
+
+  /// Get VaryingType corresponding to the C++ type.
+  template<class T> constexpr VaryingType varying_type_of();
+  template<> constexpr VaryingType varying_type_of<int32_t>() { return VaryingType::Int; }
+  template<> constexpr VaryingType varying_type_of<glm::ivec2>() { return VaryingType::IVec2; }
+  template<> constexpr VaryingType varying_type_of<glm::ivec3>() { return VaryingType::IVec3; }
+  template<> constexpr VaryingType varying_type_of<glm::ivec4>() { return VaryingType::IVec4; }
+  template<> constexpr VaryingType varying_type_of<float>() { return VaryingType::Float; }
+  template<> constexpr VaryingType varying_type_of<glm::vec2>() { return VaryingType::Vec2; }
+  template<> constexpr VaryingType varying_type_of<glm::vec3>() { return VaryingType::Vec3; }
+  template<> constexpr VaryingType varying_type_of<glm::vec4>() { return VaryingType::Vec4; }
+
+  /// Declaration of a varying written by the vertex shader and read by the fragment shader.
+  struct Varying {
+    StrId name;
+    VaryingType type;
+  };
+
+  /// Slot of a varying resolved by the program link step.
+  struct VaryingSlot {
+    uint8_t index;
   };
 
+  /**
+   * @brief Resolved slots of the program varyings.
+   *
+   * Varyings are stored in a flat array of InOutVar, where the slot of each varying is given by
+   * the order of declaration. So vertices can be copied and interpolated without any name lookup.
+   * Varyings used by name without being declared get the following slots on their first use.
+   */
+  class VaryingLayout {
+  public:
+    VaryingLayout() = default;
+    /// Assign slots to the declared varyings. Throws ProgramLinkException for invalid declarations.
+    explicit VaryingLayout(const std::vector<Varying>& varyings);
+    VaryingLayout(const VaryingLayout& other);
+    VaryingLayout& operator=(const VaryingLayout& other);
+
+    /// Get slot of the varying with given name.
+    inline Opt<VaryingSlot> Find(StrId name) const {
+      const uint8_t count = Size();
+      for (uint8_t i = 0; i < count; i++) {
+        if (m_varyings[i].name == name)
+          return VaryingSlot{ i };
+      }
+      return {};
+    }
+    /**
+     * @brief Get slot of the varying, or assign the next slot to a varying which wasn't declared.
+     *
+     * Undeclared varyings get the type they are first used with. This can be called by several
+     * shader invocations at once.
+     * @throw VaryingNotFoundException if all the slots are used.
+     */
+    VaryingSlot FindOrAdd(StrId name, VaryingType type);
+    /// Number of used slots.
+    inline uint8_t Size() const noexcept { return m_count.load(std::memory_order_acquire); }
+    inline const Varying& operator[](uint8_t slot) const { return m_varyings[slot]; }
+
+  private:
+    std::array<Varying, MAX_VARYINGS> m_varyings{};
+    /// Slots below the count are never modified, so they are read without locking.
+    std::atomic<uint8_t> m_count = 0;
+    /// Serializes adding of the undeclared varyings.
+    std::mutex m_addMutex;
+  };
+
+  /// Check (in debug builds) that the varying is accessed with the type of its slot.
+  template<class T>
+  inline void assert_varying_type([[maybe_unused]] const VaryingLayout* layout, [[maybe_unused]] VaryingSlot slot) {
+    assert((!layout || (slot.index < layout->Size() && (*layout)[slot.index].type == varying_type_of<T>()))
+           && "Varying accessed with different type");
+  }
+  /// Check (in debug builds) that the varying is accessed as an integer one.
+  inline void assert_varying_integer([[maybe_unused]] const VaryingLayout* layout, [[maybe_unused]] VaryingSlot slot) {
+    assert((!layout || (slot.index < layout->Size() && is_integer((*layout)[slot.index].type)))
+           && "Varying accessed with different type");
+  }
+
   /**
    * @brief Represents any shader and their shared properties.
+   *
+   * Shader objects aren't modified while drawing, everything a running shader writes lives in its
+   * invocation context (see ShaderContext). So the same shader can be executed by several threads.
    */
   class Shader : public UniqueId<Shader> {
   public:
-    using InOutVars = std::unordered_map<StrId, InOutVar>;
+    /// Values of all varyings (indexed by VaryingSlot::index).
+    using InOutVars = std::array<InOutVar, MAX_VARYINGS>;
 
     /// Pointer to all program uniforms
     /// @note This property is assigned to when the swrast::Program is constructed with this shader.
     UniformGroup* uniforms = nullptr;
+    /// Pointer to the uniform blocks bound to the program.
+    /// @note This property is assigned to when the swrast::Program is constructed with this shader.
+    const UniformBlocks* uniform_blocks = nullptr;
+    /// Pointer to the varying layout of the program.
+    /// @note This property is assigned to when the swrast::Program is constructed with this shader.
+    VaryingLayout* varyings = nullptr;
 
     /// Get the type of shader (vertex/fragment/...)
     inline ShaderType GetType() const noexcept { return m_type; }
-    /// Execute this shader.
-    virtual void Execute() = 0;
+
+    /**
+     * @brief Resolve the varying name into its slot.
+     *
+     * Shaders can look the slots up once and then use the slot accessors, which skip the lookup.
+     * @throw VaryingNotFoundException if the program doesn't declare the varying (and it wasn't
+     *        used by name yet).
+     */
+    VaryingSlot GetVaryingSlot(StrId name) const;
+    /**
+     * @brief Resolve the varying name into its slot. Undeclared varyings get a slot of given type.
+     * @see VaryingLayout::FindOrAdd()
+     */
+    VaryingSlot GetVaryingSlot(StrId name, VaryingType type) const;
+
+  private:
+    ShaderType m_type;
+
+  protected:
+    /**
+     * @brief Construct the shader
+     * @param type Type of shader
+     */
+    Shader(ShaderType type) : m_type(type) {}
+    virtual ~Shader() = default;
+  };
+
+  /**
+   * @brief State of a running shader invocation, which is shared by all shader types.
+   *
+   * The pipeline owns one context per worker thread and reuses it for all invocations, so
+   * executing a shader allocates nothing. Shader functions get the context instead of the shader.
+   */
+  class ShaderContext {
+  public:
+    using InOutVars = Shader::InOutVars;
+
     /**
      * @brief Get the uniform value
      * @param name Name of the uniform.
@@ -54,122 +201,579 @@ namespace swrast {
      * @return Optinal reference to the uniform variable.
      */
     template<class T>
-    OptRef<T> Uniform(StrId name) {
-      if (uniforms->count(name) == 0)
+    OptRef<T> Uniform(StrId name) const {
+      auto it = m_shader->uniforms->find(name);
+      if (it == m_shader->uniforms->end())
         return {};
-      return std::any_cast<T&>(uniforms->operator[](name));
+      return std::any_cast<T&>(it->second);
+    }
+
+    /**
+     * @brief Get the uniform block bound to the program.
+     *
+     * Unlike Uniform(), this is just an indirection, so it is cheap enough to be called per vertex
+     * or per fragment.
+     * @param binding Binding point of the block in the program.
+     * @tparam T Type the block was created with.
+     */
+    template<class T>
+    inline const T& UniformBlock(uint8_t binding) const {
+      const UniformBlocks* blocks = m_shader->uniform_blocks;
+      assert(binding < MAX_UNIFORM_BLOCKS && (*blocks)[binding].obj_ptr && "Uniform block isn't bound");
+      return (*blocks)[binding]->template As<T>();
     }
 
-    template<class T> inline T& In(StrId name) { return getInOut<T>(&m_in, name); }
-    template<class T> inline T& Out(StrId name) { return getInOut<T>(&m_out, name); }
+    /// Resolve the varying name into its slot. See Shader::GetVaryingSlot().
+    inline VaryingSlot GetVaryingSlot(StrId name) const { return m_shader->GetVaryingSlot(name); }
+
+    /// Access varying given by name. Varyings not declared by the program get a slot on the first use.
+    template<class T> inline T& In(StrId name) { return In<T>(m_shader->GetVaryingSlot(name, varying_type_of<T>())); }
+    template<class T> inline T& Out(StrId name) { return Out<T>(m_shader->GetVaryingSlot(name, varying_type_of<T>())); }
+    template<class T> inline T& In(VaryingSlot slot) {
+      assert_varying_type<T>(m_shader->varyings, slot);
+      return getInOut<T>(&m_in, slot);
+    }
+    template<class T> inline T& Out(VaryingSlot slot) {
+      assert_varying_type<T>(m_shader->varyings, slot);
+      return getInOut<T>(&m_out, slot);
+    }
 
     inline InOutVars& InVars() { return m_in; }
     inline InOutVars& OutVars() { return m_out; }
 
   private:
-    ShaderType m_type;
     /// Shader input variables
-    InOutVars m_in;
+    InOutVars m_in{};
     /// Shader output variables
-    InOutVars m_out;
+    InOutVars m_out{};
 
-    template<class T> T& getInOut(InOutVars* vars, StrId name);
   protected:
+    /// Shader being executed.
+    const Shader* m_shader = nullptr;
+
+    template<class T> static T& getInOut(InOutVars* vars, VaryingSlot slot);
+    /// Number of the used varying slots.
+    inline uint8_t varyingCount() const { return m_shader && m_shader->varyings ? m_shader->varyings->Size() : 0; }
+  };
+
+  /**
+   * @brief Inputs and outputs of a batched vertex shader invocation.
+   *
+   * The batch holds up to WIDE_LANES vertices in structure of arrays form. Lanes past `m_Count`
+   * repeat the last vertex, so shaders can compute all lanes unconditionally. Results of these
+   * lanes are ignored.
+   */
+  class VertexBatch {
+  public:
+    /// Number of valid lanes.
+    uint8_t m_Count = 0;
+    /// Input vertex indices.
+    std::array<uint32_t, WIDE_LANES> m_VertexId{};
+    /// Input instance index. A batch never mixes instances, so it's the same for all lanes.
+    uint32_t m_InstanceId = 0;
+    /// Output positions.
+    WVec4 m_Position;
+
     /**
-     * @brief Construct the shader
-     * @param func Function to execute for this shader.
-     * @param type Type of shader
+     * @brief Get the attribute of all lanes.
+     * @tparam T Type of the attribute (float, glm::vec2, glm::vec3 or glm::vec4).
+     * @return Attribute values or nothing, if there is no attribute at given location or a lane
+     *         reads outside of the vertex buffer.
      */
-    Shader(ShaderType type) : m_type(type), m_in(), m_out() {}
-    virtual ~Shader() = default;
+    template<class T>
+    Opt<Wide<T>> Attribute(uint8_t location) const {
+      if (!m_streams || m_streams->size() <= location)
+        return {};
+      const AttributeStream& stream = (*m_streams)[location];
+      assert(stream.type == attribute_type_of<T>() && "Attribute accessed with different type");
+
+      const size_t samples = stream.SampleCount();
+      if (stream.IsPerInstance()) {
+        if (stream.Sample(0, m_InstanceId) >= samples)
+          return {};
+        // All lanes share the sample of the instance.
+        T x;
+        std::memcpy(&x, stream.data + stream.Offset(0, m_InstanceId), get_byte_size(stream.type));
+        return Wide<T>(x);
+      }
+      for (uint32_t id : m_VertexId) {
+        if (id >= samples)
+          return {};
+      }
+      Wide<T> values;
+      stream.fetch(stream.data, stream.stride, m_VertexId.data(), reinterpret_cast<float*>(&values));
+      return values;
+    }
+
+    /// Write float varying of all lanes.
+    inline void Out(VaryingSlot slot, const WFloat& value) {
+      assert_varying_type<float>(m_varyings, slot);
+      m_out[slot.index][0] = value;
+    }
+    template<int N>
+    inline void Out(VaryingSlot slot, const WVec<N>& value) {
+      assert_varying_type<glm::vec<N, float>>(m_varyings, slot);
+      for (int i = 0; i < N; i++)
+        m_out[slot.index][i] = value[i];
+    }
+    /// Write integer varying of a single lane.
+    inline void OutLane(VaryingSlot slot, uint8_t lane, const glm::ivec4& value) {
+      assert_varying_integer(m_varyings, slot);
+      InOutVar var;
+      var.i4 = value;
+      m_out[slot.index].SetLane(lane, var.f4);
+    }
+    /**
+     * @brief Write varying given by name. Slower than using the slot, see Shader::GetVaryingSlot().
+     *
+     * Varyings not declared by the program get a slot on the first use.
+     */
+    inline void Out(StrId name, const WFloat& value) { Out(findOrAdd(name, VaryingType::Float), value); }
+    template<int N>
+    inline void Out(StrId name, const WVec<N>& value) {
+      Out(findOrAdd(name, varying_type_of<glm::vec<N, float>>()), value);
+    }
+
+    /// Set all the outputs of a single lane (used to run single vertex shaders in batches).
+    void SetLane(uint8_t lane, const glm::vec4& position, const Shader::InOutVars& vars);
+    /// Get all the outputs of a single lane.
+    void GetLane(uint8_t lane, glm::vec4& position, Shader::InOutVars& vars) const;
+
+  private:
+    friend class VertexShader;
+
+    const std::vector<AttributeStream>* m_streams = nullptr;
+    VaryingLayout* m_varyings = nullptr;
+    /// Output varyings. Integer varyings are stored bit-wise.
+    std::array<WVec4, MAX_VARYINGS> m_out;
+
+    inline VaryingSlot findOrAdd(StrId name, VaryingType type) {
+      if (!m_varyings)
+        RAISE(VaryingNotFoundException, name);
+      return m_varyings->FindOrAdd(name, type);
+    }
   };
 
-  /// Represents the vertex shader
-  class VertexShader : public Shader {
+  class VertexShader;
+
+  /// State of a running vertex shader invocation. See ShaderContext.
+  class VertexContext : public ShaderContext {
   public:
     /// Output position of the vertex.
-    glm::vec4 m_Position;
+    glm::vec4 m_Position{};
     /// Input vertex index.
-    uint32_t m_VertexId;
-    /// Input vertex attributes as defined in vertex array.
-    std::vector<std::any> m_Attributes;
+    uint32_t m_VertexId = 0;
+    /// Input instance index. Zero for draws without instancing.
+    uint32_t m_InstanceId = 0;
 
-    VertexShader(std::function<void(VertexShader*)> func)
-      : Shader(ShaderType::Vertex)
-      , m_Position(), m_VertexId(0), m_Attributes(), m_func(func) {};
+    /**
+     * @brief Prepare the context for executing the shader.
+     * @param streams Attribute streams of the vertex array used for drawing. They must stay valid
+     *                while the context is bound.
+     */
+    void Bind(const VertexShader* shader, const std::vector<AttributeStream>* streams);
 
     /**
      * @brief Get the attribute value
+     *
+     * The reference points directly into the vertex buffer. Only attributes which aren't aligned
+     * enough for T are copied into a per-context scratch storage first.
      * @param location Index of the vertex attribute. This is the same index as when vertex array was constructed.
      * @tparam Type of the vertex attribute.
-     * @return Optional reference to the vertex attribute.
+     * @return Optional reference to the vertex attribute, empty if there is no attribute at given
+     *         location or the vertex lies outside of the vertex buffer.
      */
     template<class T>
-    OptRef<T> Attribute(uint8_t location) {
-      if (m_Attributes.size() <= location)
+    OptRef<const T> Attribute(uint8_t location) {
+      if (!m_streams || m_streams->size() <= location)
         return {};
-      return std::any_cast<T&>(m_Attributes[location]);
+      const AttributeStream& stream = (*m_streams)[location];
+      assert(stream.type == attribute_type_of<T>() && "Attribute accessed with different type");
+      if (stream.Sample(m_VertexId, m_InstanceId) >= stream.SampleCount())
+        return {};
+
+      size_t size = get_byte_size(stream.type);
+      const uint8_t* p = stream.data + stream.Offset(m_VertexId, m_InstanceId);
+      if (sizeof(T) != size || reinterpret_cast<uintptr_t>(p) % alignof(T) != 0) {
+        std::memcpy(m_scratch[location].bytes, p, size);
+        p = m_scratch[location].bytes;
+      }
+      return *reinterpret_cast<const T*>(p);
     }
 
-    void Execute() override {
-      m_func(this);
+  private:
+    friend class VertexShader;
+
+    /// Storage for a single attribute of any type.
+    struct alignas(16) AttributeScratch { uint8_t bytes[64]; };
+
+    const std::vector<AttributeStream>* m_streams = nullptr;
+    /// Only grows, so rebinding the context doesn't allocate once it has seen the largest vertex array.
+    std::vector<AttributeScratch> m_scratch;
+    /// Batch used when a batched shader is executed for a single vertex.
+    VertexBatch m_singleBatch;
+  };
+
+  /**
+   * @brief Represents the vertex shader
+   *
+   * The shader is either a function processing a single vertex or a function processing a whole
+   * VertexBatch. Both kinds can be executed either way, the missing entry point is emulated.
+   */
+  class VertexShader : public Shader {
+  public:
+    using Func = std::function<void(VertexContext*)>;
+    using BatchFunc = std::function<void(VertexContext*, VertexBatch&)>;
+
+    VertexShader(Func func)
+      : Shader(ShaderType::Vertex), m_func(func) {};
+    VertexShader(BatchFunc func)
+      : Shader(ShaderType::Vertex), m_batchFunc(func) {};
+
+    /// Check if the shader has the batched entry point.
+    inline bool IsBatched() const noexcept { return bool(m_batchFunc); }
+
+    /// Execute the shader for the vertex VertexContext::m_VertexId of instance VertexContext::m_InstanceId.
+    void Execute(VertexContext& ctx) const;
+    /**
+     * @brief Execute the shader for all vertices of the batch.
+     *
+     * The batch gets the instance of the context. Single vertex shaders are executed for each
+     * valid lane of the batch.
+     */
+    void ExecuteBatch(VertexContext& ctx, VertexBatch& batch) const;
+  private:
+    Func m_func;
+    BatchFunc m_batchFunc;
+  };
+
+  /// Describes what the fragment shader does, so the pipeline knows which optimizations are safe.
+  struct FragmentShaderSpec {
+    /// The shader writes FragmentContext::m_FragDepth.
+    bool writes_depth = false;
+    /// The shader may call FragmentContext::Discard() or FragmentBatch::Discard(). Disables early depth test.
+    bool discards = false;
+  };
+
+  /**
+   * @brief Inputs and outputs of a batched fragment shader invocation.
+   *
+   * The batch is a pair of 2x2 quads, so it covers 4x2 pixels. Lane index is `y * 4 + x`, the
+   * first quad has lanes 0, 1, 4, 5 and the second 2, 3, 6, 7. Lanes not in `m_Mask` are helpers
+   * (or lie in a quad with no covered pixel at all), their outputs are ignored.
+   *
+   * Batches without `m_Quads` (fragments of lines) hold an unrelated pixel in each lane instead,
+   * so there are no helpers and the derivatives are zero.
+   *
+   * Shader discards fragments by removing their lanes from the mask (see Discard()).
+   */
+  class FragmentBatch {
+  public:
+    /// Width of the batch in pixels.
+    static constexpr uint8_t WIDTH = 4;
+
+    /// Mask of the lanes covered by the primitive and not discarded.
+    uint8_t m_Mask = 0;
+    /// Whether the lanes form 2x2 quads.
+    bool m_Quads = true;
+    /// Input fragment coordinates.
+    WVec4 m_FragCoord;
+    /// Output colors.
+    WVec4 m_FragColor;
+    /// Output depths. Initialized to m_FragCoord.z, written only by shaders with `writes_depth`.
+    WFloat m_FragDepth;
+
+    /**
+     * @brief Get the float input variable of all lanes.
+     * @tparam T Type of the varying (float, glm::vec2, glm::vec3 or glm::vec4).
+     */
+    template<class T>
+    inline Wide<T> In(VaryingSlot slot) const {
+      assert_varying_type<T>(m_varyings, slot);
+      return component<T>(m_in[slot.index]);
+    }
+    /// Get integer input variable. These aren't interpolated, so they are the same for all lanes.
+    inline glm::ivec4 InFlat(VaryingSlot slot) const {
+      assert_varying_integer(m_varyings, slot);
+      InOutVar var;
+      var.f4 = m_in[slot.index].Lane(0);
+      return var.i4;
     }
+    /**
+     * @brief Get float input variable given by name. Slower than using the slot, see Shader::GetVaryingSlot().
+     *
+     * Varyings not declared by the program get a slot on the first use.
+     */
+    template<class T>
+    inline Wide<T> In(StrId name) const {
+      if (!m_varyings)
+        RAISE(VaryingNotFoundException, name);
+      return In<T>(m_varyings->FindOrAdd(name, varying_type_of<T>()));
+    }
+
+    /**
+     * @brief Get derivative of the input variable in screen space x direction.
+     * @note As with FragmentContext::dFdx(), the derivative is computed from the first row of the
+     *       quad, so it is the same for all lanes of the quad. It is zero for batches without quads.
+     */
+    template<class T>
+    inline Wide<T> dFdx(VaryingSlot slot) const { return component<T>(quadDiff(m_in[slot.index], 1)); }
+    /// Get derivative of the input variable in screen space y direction. See dFdx().
+    template<class T>
+    inline Wide<T> dFdy(VaryingSlot slot) const { return component<T>(quadDiff(m_in[slot.index], WIDTH)); }
+
+    /**
+     * @brief Discard fragments of given lanes, so they aren't written into the framebuffer.
+     *
+     * The shader continues to run for these lanes, so they still provide values for derivatives.
+     * @note Only shaders declared with FragmentShaderSpec::discards may discard.
+     */
+    inline void Discard(uint8_t lanes) { m_Mask &= ~lanes; }
+
+    /// Set all the inputs of a single lane (used to run single fragment shaders in batches).
+    void SetLaneInputs(uint8_t lane, const Shader::InOutVars& vars);
+    /// Get all the inputs of a single lane.
+    void GetLaneInputs(uint8_t lane, Shader::InOutVars& vars) const;
+    /// Get input variables of all lanes, indexed by the varying slot. Integer varyings are stored bit-wise.
+    inline std::array<WVec4, MAX_VARYINGS>& InVars() { return m_in; }
+
   private:
-    std::function<void(VertexShader*)> m_func;
+    friend class FragmentShader;
+
+    VaryingLayout* m_varyings = nullptr;
+    std::array<WVec4, MAX_VARYINGS> m_in;
+
+    template<class T>
+    static inline Wide<T> component(const WVec4& v) {
+      if constexpr (std::is_same_v<T, float>) {
+        return v[0];
+      } else {
+        Wide<T> r;
+        for (int i = 0; i < T::length(); i++)
+          r[i] = v[i];
+        return r;
+      }
+    }
+
+    /// Difference of the lane `step` after the first lane of the quad and the first lane.
+    inline WVec4 quadDiff(const WVec4& v, uint8_t step) const {
+      WVec4 r;
+      if (!m_Quads) {
+        for (int i = 0; i < 4; i++)
+          r[i] = WFloat(0.0f);
+        return r;
+      }
+      for (int i = 0; i < 4; i++) {
+        for (uint8_t lane = 0; lane < WIDE_LANES; lane++) {
+          uint8_t first = lane & 0b010;
+          r[i][lane] = v[i][first + step] - v[i][first];
+        }
+      }
+      return r;
+    }
   };
 
-  /// This class represents the fragment shader.
-  class FragmentShader : public Shader {
+  class FragmentShader;
+
+  /**
+   * @brief State of a running fragment shader invocation. See ShaderContext.
+   *
+   * Fragments are shaded in quads of 2x2 pixels (lane index has x in bit 0 and y in bit 1). Pixels
+   * of the quad not covered by the primitive are shaded as helper invocations, whose results are
+   * thrown away. They only exist so that dFdx() and dFdy() have the neighbouring values.
+   */
+  class FragmentContext : public ShaderContext {
   public:
+    /// Number of pixels shaded together.
+    static constexpr uint8_t QUAD_LANES = 4;
+
     /// Input fragment coordinates.
-    glm::vec4 m_FragCoord;
+    glm::vec4 m_FragCoord{};
     /// Input front facing flag
-    bool m_FrontFacing;
+    bool m_FrontFacing = false;
     /// Input point coordinates
-    glm::vec2 m_PointCoord;
+    glm::vec2 m_PointCoord{};
     /// Output color.
-    glm::vec4 m_FragColor;
+    glm::vec4 m_FragColor{};
+    /// Output depth. Initialized to m_FragCoord.z, written only by shaders with `writes_depth`.
+    float m_FragDepth = 0.0f;
+    /// Input flag telling if the current invocation is a helper.
+    bool m_HelperInvocation = false;
+
+    /// Fragment coordinates of the quad pixels.
+    std::array<glm::vec4, QUAD_LANES> m_QuadFragCoord{};
+    /// Output colors of the quad pixels.
+    std::array<glm::vec4, QUAD_LANES> m_QuadFragColor{};
+    /// Output depths of the quad pixels.
+    std::array<float, QUAD_LANES> m_QuadFragDepth{};
+    /// Mask of the quad pixels covered by the primitive.
+    uint8_t m_QuadMask = 0;
+
+    /// Prepare the context for executing the shader.
+    inline void Bind(const FragmentShader* shader);
+
+    /**
+     * @brief Discard the current fragment, so it isn't written into the framebuffer.
+     *
+     * This only marks the fragment, the shader should return right after the call.
+     * @note Only shaders declared with FragmentShaderSpec::discards may discard.
+     */
+    inline void Discard();
+    /// Check if the current fragment was discarded.
+    inline bool IsDiscarded() const noexcept { return m_discarded; }
 
-    FragmentShader(std::function<void(FragmentShader*)> func)
-      : Shader(ShaderType::Fragment)
-      , m_FragCoord(), m_FrontFacing(false), m_PointCoord(), m_func(func) {}
+    /**
+     * @brief Get derivative of the input variable in screen space x direction.
+     * @note The derivative is computed from the first row of the quad, so it is the same for every
+     *       pixel in the quad.
+     */
+    template<class T>
+    T dFdx(VaryingSlot slot) { return getInOut<T>(&QuadInVars(1), slot) - getInOut<T>(&QuadInVars(0), slot); }
+    /// Get derivative of the input variable in screen space y direction. See dFdx().
+    template<class T>
+    T dFdy(VaryingSlot slot) { return getInOut<T>(&QuadInVars(2), slot) - getInOut<T>(&QuadInVars(0), slot); }
+    template<class T> inline T dFdx(StrId name) { return dFdx<T>(GetVaryingSlot(name)); }
+    template<class T> inline T dFdy(StrId name) { return dFdy<T>(GetVaryingSlot(name)); }
 
-    /// Discards the current fragment.
-    void Discard() { RAISEn(NotImplementedException); }
+    /// Get input variables of given pixel of the quad.
+    inline InOutVars& QuadInVars(uint8_t lane) { return lane == m_quadLane ? InVars() : m_quadIn[lane]; }
 
-    void Execute() override {
-      m_func(this);
+  private:
+    friend class FragmentShader;
+
+    /// Input variables of the quad lanes. Lane being executed has its variables in InVars().
+    std::array<InOutVars, QUAD_LANES> m_quadIn{};
+    uint8_t m_quadLane = QUAD_LANES;
+    bool m_discarded = false;
+    /// Batch used when a batched shader is executed for a single fragment.
+    FragmentBatch m_singleBatch;
+
+    /// Swap only the used slots, the rest holds no data.
+    inline void swapInputs(uint8_t lane) {
+      std::swap_ranges(InVars().begin(), InVars().begin() + varyingCount(), m_quadIn[lane].begin());
     }
-  protected:
-    std::function<void(FragmentShader*)> m_func;
   };
 
+  /**
+   * @brief This class represents the fragment shader.
+   *
+   * The shader is either a function processing a single fragment or a function processing a whole
+   * FragmentBatch. The pipeline always shades batches, single fragment shaders are executed quad
+   * by quad.
+   */
+  class FragmentShader : public Shader {
+  public:
+    using Func = std::function<void(FragmentContext*)>;
+    using BatchFunc = std::function<void(FragmentContext*, FragmentBatch&)>;
+
+    FragmentShader(Func func, const FragmentShaderSpec& spec = {})
+      : Shader(ShaderType::Fragment), m_func(func), m_spec(spec) {}
+    FragmentShader(BatchFunc func, const FragmentShaderSpec& spec = {})
+      : Shader(ShaderType::Fragment), m_batchFunc(func), m_spec(spec) {}
+
+    /// Check if the shader has the batched entry point.
+    inline bool IsBatched() const noexcept { return bool(m_batchFunc); }
+
+    inline const FragmentShaderSpec& GetSpec() const noexcept { return m_spec; }
+
+    /**
+     * @brief Check if the depth test can be done before the shader is executed.
+     *
+     * The final depth and visibility of the fragment are known in advance only when the shader
+     * neither writes depth nor discards.
+     */
+    inline bool AllowsEarlyDepth() const noexcept { return !m_spec.writes_depth && !m_spec.discards; }
+
+    /// Shade the single fragment FragmentContext::m_FragCoord.
+    void Execute(FragmentContext& ctx) const;
+
+    /**
+     * @brief Shade all lanes of the batch.
+     *
+     * Single fragment shaders are executed with ExecuteQuad() for each quad with a covered lane.
+     * Batches without quads run them just for the covered lanes.
+     */
+    void ExecuteBatch(FragmentContext& ctx, FragmentBatch& batch) const;
+
+    /**
+     * @brief Shade the whole quad with the single fragment entry point.
+     *
+     * Reads m_QuadFragCoord, m_QuadMask and QuadInVars() of every lane of the context and writes
+     * m_QuadFragColor and m_QuadFragDepth.
+     */
+    void ExecuteQuad(FragmentContext& ctx) const;
+  private:
+    /// Run the single fragment entry point for a lane of the context quad.
+    void executeLane(FragmentContext& ctx, uint8_t lane) const;
+
+    Func m_func;
+    BatchFunc m_batchFunc;
+    FragmentShaderSpec m_spec;
+  };
+
+  inline void FragmentContext::Bind(const FragmentShader* shader) { m_shader = shader; }
+  inline void FragmentContext::Discard() {
+    assert(static_cast<const FragmentShader*>(m_shader)->GetSpec().discards && "Shader discards without FragmentShaderSpec::discards");
+    m_discarded = true;
+  }
+
   /// This struct represents parameters passed to Program.
   /// @note We use this, because there could be new optionall shadere entries in the future.
   struct ProgramSpec {
     ObjectHandle<VertexShader> vertex_shader;
     ObjectHandle<FragmentShader> fragment_shader;
+    /// Varyings written by the vertex shader and read by the fragment shader.
+    std::vector<Varying> varyings;
+    /// Uniform blocks bound to the binding points 0, 1, ...
+    std::vector<ObjectHandle<UniformBuffer>> uniform_blocks;
   };
 
   class Program : public UniqueId<Program> {
     UniformGroup m_uniforms;
     ObjectHandle<VertexShader> m_vertexShader;
     ObjectHandle<FragmentShader> m_fragmentShader;
+    VaryingLayout m_varyings;
+    UniformBlocks m_uniformBlocks;
     template<typename T>
     friend ObjectHandle<T> State::CreateObject(T&& obj);
   public:
-    Program(const ProgramSpec&& spec) : m_uniforms(), m_vertexShader(spec.vertex_shader) , m_fragmentShader(spec.fragment_shader) {
-    }
+    /// Link the program. This resolves the declared varyings into slots.
+    Program(const ProgramSpec&& spec);
     Program() = default;
 
     Program& Use();
 
+    /// Set uniform accessed by name. This is slow, prefer uniform blocks for values read by every vertex or fragment.
     inline void SetUniform(StrId name, const std::any& value) {
       m_uniforms[name] = value;
     }
 
+    /**
+     * @brief Write the whole uniform block of type T bound to this program.
+     * @note Blocks are shared, so this changes the value for every program the block is bound to.
+     * @except ObjectNotFoundException if no block of type T is bound.
+     */
+    template<class T>
+    void SetUniform(const T& value) {
+      for (auto& block : m_uniformBlocks) {
+        if (block.obj_ptr && block->template Holds<T>()) {
+          block->Set(value);
+          return;
+        }
+      }
+      RAISE(ObjectNotFoundException, Id);
+    }
+
+    /// Bind uniform block to given binding point. Pass an empty handle to unbind it.
+    inline void SetUniformBlock(uint8_t binding, ObjectHandle<UniformBuffer> block) {
+      if (binding >= MAX_UNIFORM_BLOCKS)
+        RAISE(ProgramLinkException, "Uniform block binding out of range");
+      m_uniformBlocks[binding] = block;
+    }
+
     auto& GetVertexShader() { return m_vertexShader; }
     auto& GetFragmentShader() { return m_fragmentShader; }
+    inline const VaryingLayout& GetVaryingLayout() const { return m_varyings; }
   };
 
   template<> OptRef<VertexShader> State::GetObject(ObjectId id);
@@ -179,12 +783,12 @@ namespace swrast {
   template<> ObjectHandle<FragmentShader> State::CreateObject(FragmentShader&& obj);
   template<> ObjectHandle<Program> State::CreateObject(Program&& obj);
 
-  template<> int32_t& Shader::getInOut(Shader::InOutVars* vars, StrId name);
-  template<> glm::ivec2& Shader::getInOut(Shader::InOutVars* vars, StrId name);
-  template<> glm::ivec3& Shader::getInOut(Shader::InOutVars* vars, StrId name);
-  template<> glm::ivec4& Shader::getInOut(Shader::InOutVars* vars, StrId name);
-  template<> float& Shader::getInOut(Shader::InOutVars* vars, StrId name);
-  template<> glm::vec2& Shader::getInOut(Shader::InOutVars* vars, StrId name);
-  template<> glm::vec3& Shader::getInOut(Shader::InOutVars* vars, StrId name);
-  template<> glm::vec4& Shader::getInOut(Shader::InOutVars* vars, StrId name);
+  template<> int32_t& ShaderContext::getInOut(InOutVars* vars, VaryingSlot slot);
+  template<> glm::ivec2& ShaderContext::getInOut(InOutVars* vars, VaryingSlot slot);
+  template<> glm::ivec3& ShaderContext::getInOut(InOutVars* vars, VaryingSlot slot);
+  template<> glm::ivec4& ShaderContext::getInOut(InOutVars* vars, VaryingSlot slot);
+  template<> float& ShaderContext::getInOut(InOutVars* vars, VaryingSlot slot);
+  template<> glm::vec2& ShaderContext::getInOut(InOutVars* vars, VaryingSlot slot);
+  template<> glm::vec3& ShaderContext::getInOut(InOutVars* vars, VaryingSlot slot);
+  template<> glm::vec4& ShaderContext::getInOut(InOutVars* vars, VaryingSlot slot);
 } // namespace swrast
@@ -8,6 +8,7 @@
 #include <functional>
 #include <glm/glm.hpp>
 #include <optional>
+#include <span>
 #include <unordered_map>
 #include <any>
 #include "swrast_private.h"
@@ -18,6 +19,8 @@ namespace swrast {
   template<class T> struct ObjectHandle;
   class VertexBuffer;
   class IndexBuffer;
+  class IndirectBuffer;
+  class UniformBuffer;
   class VertexArray;
   class Texture;
   class Framebuffer;
@@ -29,6 +32,45 @@ namespace swrast {
     None, CW, CCW
   };
 
+  /// Methods of triangle rasterization.
+  enum class RasterMode : uint8_t {
+    Float,        ///< Floating point edge functions. Pixels on shared edges are shaded by both triangles.
+    FixedPoint,   ///< Vertices snapped to 1/256 of a pixel, integer edge functions and top-left fill rule.
+  };
+
+  /// Backends which can be used for rasterization and fragment processing.
+  enum class RenderBackend : uint8_t {
+    Serial,   ///< Rasterize and shade all primitives on the calling thread.
+    Tiled,    ///< Bin primitives into screen tiles and rasterize the tiles on worker threads.
+  };
+
+  /// Instruction sets which can be used by the SIMD kernels.
+  enum class SimdIsa : uint8_t {
+    Scalar,   ///< No SIMD, reference implementation.
+    SSE2,     ///< 4 lanes wide.
+    AVX2,     ///< 8 lanes wide.
+  };
+
+  /// Parameters used when initializing the State.
+  struct StateSpec {
+    RenderBackend backend = RenderBackend::Serial;
+    uint32_t worker_count = 0;  ///< Number of worker threads used by the tiled backend. 0 for hardware concurrency.
+    uint32_t tile_size = 64;    ///< Size of the screen tiles in pixels used by the tiled backend (rounded up to multiple of 8).
+    Opt<SimdIsa> simd_isa = {}; ///< Instruction set to use. If not set (or unsupported), then the best supported one is used.
+  };
+
+  /**
+   * @brief Parameters of a single draw of a multi-draw.
+   *
+   * The layout follows the indirect draw commands of other APIs, so draw lists can be built once
+   * and stored in an IndirectBuffer.
+   */
+  struct DrawRecord {
+    uint32_t count;       ///< Number of indices (or vertices for non-indexed draws).
+    uint32_t first;       ///< First index (or vertex for non-indexed draws) to draw.
+    int32_t base_vertex;  ///< Value added to each index before fetching the vertex. Ignored by non-indexed draws.
+  };
+
   /**
    * @brief Main rasterizer state.
    *
@@ -37,6 +79,8 @@ namespace swrast {
   struct State {
     static std::unordered_map<ObjectId, VertexBuffer> m_vbos;
     static std::unordered_map<ObjectId, IndexBuffer> m_ibos;
+    static std::unordered_map<ObjectId, IndirectBuffer> m_indirectBufs;
+    static std::unordered_map<ObjectId, UniformBuffer> m_ubos;
     static std::unordered_map<ObjectId, VertexArray> m_vaos;
     static std::unordered_map<ObjectId, Texture> m_textures;
     static std::unordered_map<ObjectId, Framebuffer> m_fbos;
@@ -57,12 +101,34 @@ namespace swrast {
     inline static bool m_DepthTest = false;
     /// Enable/Disable wireframe rendering mode.
     inline static bool m_WriteFrame = false;
+    /// How should be the triangles rasterized.
+    inline static RasterMode m_RasterMode = RasterMode::Float;
+    /**
+     * @brief Size of the guard band as a multiple of the viewport.
+     *
+     * Triangles inside of the guard band are rasterized without clipping against the sides of the
+     * frustum. Only triangles crossing it are clipped, so the screen space coordinates stay small
+     * enough for the raster math.
+     */
+    inline static float m_GuardBand = 8.0f;
+    /// Enable/Disable the fast path for triangles covering just a few pixels.
+    inline static bool m_SmallTriangles = true;
+    /// Enable/Disable rejection of triangles and raster blocks hidden according to the Hi-Z buffer.
+    inline static bool m_OcclusionCulling = true;
+    /**
+     * @brief Enable/Disable primitive restart in indexed draws.
+     *
+     * The largest value of the index type (see restart_index()) then doesn't reference a vertex, but
+     * ends the current strip, fan or list, so one draw can submit many of them.
+     */
+    inline static bool m_PrimitiveRestart = false;
 
     /**
      * @brief Initialize the state.
      * @param fb_size Dimensions of the default framebuffer.
+     * @param spec Rendering backend configuration.
      */
-    static void Init(glm::uvec2 fb_size);
+    static void Init(glm::uvec2 fb_size, const StateSpec& spec = {});
 
     /// Destroy the state and all its allocated resources.
     static void Destroy();
@@ -81,14 +147,57 @@ namespace swrast {
      * @param primitive Primitives to draw
      * @param offset Offset into the VBO's
      * @param count Number of vertices to be rendered.
+     * @except DrawRangeException if the vertices don't fit into the vertex buffers.
      */
     static void DrawArrays(Primitive primitive, size_t offset, size_t count);
     /**
      * @brief Draw indexed
      * @param primitive PRimitives to draw
      * @param count Number of indices to use.
+     * @param offset Index of the first used index in the index buffer.
+     * @param base_vertex Value added to each index before fetching the vertex.
+     * @except DrawRangeException if the range doesn't fit into the index buffer or the indexed
+     *         vertices into the vertex buffers.
+     */
+    static void DrawIndexed(Primitive primitive, size_t count, size_t offset = 0, int32_t base_vertex = 0);
+    /**
+     * @brief Draw unindexed several times
+     *
+     * Each instance gets its VertexContext::m_InstanceId and samples its per instance attributes.
+     * @param instance_count Number of instances to draw.
+     * @except DrawRangeException if the vertices don't fit into the vertex buffers or a per instance
+     *         attribute doesn't have enough samples.
+     */
+    static void DrawArraysInstanced(Primitive primitive, size_t offset, size_t count, uint32_t instance_count);
+    /**
+     * @brief Draw indexed several times
+     *
+     * Indices are processed just once and only the vertex shading is repeated for each instance.
+     * @param instance_count Number of instances to draw.
+     * @except DrawRangeException if the range doesn't fit into the index buffer, the indexed vertices
+     *         into the vertex buffers or a per instance attribute doesn't have enough samples.
+     * @see DrawIndexed(), DrawArraysInstanced()
+     */
+    static void DrawIndexedInstanced(Primitive primitive, size_t count, uint32_t instance_count,
+                                     size_t offset = 0, int32_t base_vertex = 0);
+    /**
+     * @brief Execute several unindexed draws with the same state.
+     *
+     * Behaves as a DrawArrays() call for each record, but the per draw setup is done just once.
+     * @except DrawRangeException if the vertices of any record don't fit into the vertex buffers.
+     */
+    static void MultiDrawArrays(Primitive primitive, std::span<const DrawRecord> draws);
+    /**
+     * @brief Execute several indexed draws with the same state.
+     *
+     * Behaves as a DrawIndexed() call for each record, but the per draw setup is done just once and
+     * the shaded vertices are shared by the draws.
+     * @except DrawRangeException if any range doesn't fit into the index buffer or the indexed
+     *         vertices into the vertex buffers.
      */
-    static void DrawIndexed(Primitive primitive, size_t count);
+    static void MultiDrawIndexed(Primitive primitive, std::span<const DrawRecord> draws);
+    /// Execute indexed draws stored in the buffer. See MultiDrawIndexed().
+    static void MultiDrawIndexedIndirect(Primitive primitive, const ObjectHandle<IndirectBuffer>& draws);
 
     /**
      * @brief Set how the faces should be culled.
@@ -0,0 +1,82 @@
+/**
+ * @file state/UniformBuffer.h
+ * @brief This file contains declaration of uniform buffer.
+ * @author Jakub Kloub, xkloub03, VUT FIT
+ */
+#pragma once
+#include <cassert>
+#include <cstddef>
+#include <cstring>
+#include <type_traits>
+#include <typeinfo>
+#include <vector>
+#include "state/State.h"
+#include "swrast_private.h"
+
+namespace swrast {
+  /**
+   * @brief Block of uniform values with layout given by a user defined struct.
+   *
+   * The block is bound to programs (see ProgramSpec::uniform_blocks), whose shaders read it
+   * directly as `const T&` using Shader::UniformBlock(). One block can be bound to several
+   * programs, so shared data (e.g. camera) is written just once per frame.
+   */
+  class UniformBuffer : public UniqueId<UniformBuffer> {
+  public:
+    /// Create block holding value of type T.
+    template<class T>
+    static UniformBuffer Create(const T& value = {}) {
+      static_assert(std::is_trivially_copyable_v<T>, "Uniform block must be trivially copyable");
+      static_assert(alignof(T) <= alignof(Chunk), "Uniform block is over-aligned");
+      UniformBuffer ubo(sizeof(T), &typeid(T));
+      ubo.Set(value);
+      return ubo;
+    }
+    UniformBuffer() = default;
+
+    /// Check if the block was created with type T.
+    template<class T>
+    inline bool Holds() const { return m_type && *m_type == typeid(T); }
+
+    /// Get the block contents. T must be the type the block was created with.
+    template<class T>
+    inline T& As() {
+      assert(Holds<T>() && "Uniform block accessed with different type");
+      return *reinterpret_cast<T*>(m_data.data());
+    }
+    template<class T>
+    inline const T& As() const {
+      assert(Holds<T>() && "Uniform block accessed with different type");
+      return *reinterpret_cast<const T*>(m_data.data());
+    }
+
+    /// Write the whole block.
+    template<class T>
+    inline void Set(const T& value) { As<T>() = value; }
+
+    /// Write `size` bytes at `offset` into the block (e.g. a single member).
+    inline void Write(size_t offset, const void* data, size_t size) {
+      assert(offset + size <= m_size);
+      std::memcpy(reinterpret_cast<std::byte*>(m_data.data()) + offset, data, size);
+    }
+
+    /// Get size of the block in bytes.
+    inline size_t GetSize() const noexcept { return m_size; }
+
+  private:
+    /// Storage unit, which makes the block aligned for SIMD types (glm::vec4, glm::mat4).
+    struct alignas(16) Chunk { std::byte bytes[16]; };
+
+    std::vector<Chunk> m_data;
+    size_t m_size = 0;
+    const std::type_info* m_type = nullptr;
+
+    UniformBuffer(size_t size, const std::type_info* type)
+      : m_data((size + sizeof(Chunk) - 1) / sizeof(Chunk)), m_size(size), m_type(type) {}
+  };
+
+  template<>
+  OptRef<UniformBuffer> State::GetObject(ObjectId id);
+  template<>
+  ObjectHandle<UniformBuffer> State::CreateObject(UniformBuffer&& ubo);
+} // namespace swrast
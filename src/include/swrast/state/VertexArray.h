@@ -8,6 +8,7 @@
 #include "state/VertexBuffer.h"
 #include "swrast_private.h"
 #include <glm/glm.hpp>
+#include <cstdint>
 #include <optional>
 #include <vector>
 
@@ -18,12 +19,80 @@ namespace swrast {
 
   uint32_t get_byte_size(AttributeType type);
 
+  /**
+   * @brief Fetch attribute of WIDE_LANES vertices into structure of arrays form.
+   * @param data First sample of the attribute.
+   * @param stride Number of bytes between the samples.
+   * @param vertex_ids Index of the sample of each lane.
+   * @param out Component `c` of lane `i` is written to `out[c * WIDE_LANES + i]` (the layout of WVec).
+   * @see get_fetch_kernel()
+   */
+  using FetchKernel = void (*)(const uint8_t* data, size_t stride, const uint32_t* vertex_ids, float* out);
+
+  /// Get AttributeType corresponding to the C++ type.
+  template<class T> constexpr AttributeType attribute_type_of();
+  template<> constexpr AttributeType attribute_type_of<int32_t>() { return AttributeType::Int32; }
+  template<> constexpr AttributeType attribute_type_of<float>() { return AttributeType::Float32; }
+  template<> constexpr AttributeType attribute_type_of<glm::vec2>() { return AttributeType::Vec2; }
+  template<> constexpr AttributeType attribute_type_of<glm::ivec2>() { return AttributeType::IVec2; }
+  template<> constexpr AttributeType attribute_type_of<glm::vec3>() { return AttributeType::Vec3; }
+  template<> constexpr AttributeType attribute_type_of<glm::ivec3>() { return AttributeType::IVec3; }
+  template<> constexpr AttributeType attribute_type_of<glm::vec4>() { return AttributeType::Vec4; }
+  template<> constexpr AttributeType attribute_type_of<glm::ivec4>() { return AttributeType::IVec4; }
+  template<> constexpr AttributeType attribute_type_of<glm::mat3>() { return AttributeType::Mat3; }
+  template<> constexpr AttributeType attribute_type_of<glm::mat4>() { return AttributeType::Mat4; }
+
   /// Represents a single vertex array attribute.
   struct VertexAttribute {
     ObjectHandle<VertexBuffer> vbo;   ///< Buffer to sample from
     AttributeType type;               ///< Type of single element component.
     size_t stride;                    ///< Number of bytes to skip to get new sample.
     size_t offset;                    ///< Offset to first sample
+    /// Number of instances using the same sample. Zero means the attribute is sampled per vertex.
+    uint32_t divisor = 0;
+  };
+
+  /**
+   * @brief Resolved location of a vertex attribute in memory.
+   *
+   * Attribute of vertex `id` starts at `data + id * stride`, per instance attributes are indexed by
+   * `instance / divisor` instead. Streams point straight into the vertex buffers, so they are valid
+   * only until the buffer data is modified.
+   */
+  struct AttributeStream {
+    const uint8_t* data;
+    size_t stride;
+    AttributeType type;
+    /// Number of bytes from `data` to the end of the vertex buffer.
+    size_t size;
+    /// See VertexAttribute::divisor.
+    uint32_t divisor;
+    /// Kernel fetching the attribute for a whole VertexBatch. Selected by the renderer for each draw,
+    /// empty for matrix attributes.
+    FetchKernel fetch;
+
+    /// Check if the attribute is the same for all vertices of an instance.
+    inline bool IsPerInstance() const { return divisor != 0; }
+    /**
+     * @brief Get number of the samples which fit into the vertex buffer.
+     *
+     * Zero stride makes the attribute constant, its one sample is then used by any number of
+     * vertices (or instances) and SIZE_MAX is returned.
+     */
+    inline size_t SampleCount() const {
+      const size_t bytes = get_byte_size(type);
+      if (size < bytes)
+        return 0;
+      return stride == 0 ? SIZE_MAX : (size - bytes) / stride + 1;
+    }
+    /// Get index of the sample used by given vertex of given instance.
+    inline size_t Sample(uint32_t vertex_id, uint32_t instance_id) const {
+      return divisor ? instance_id / divisor : vertex_id;
+    }
+    /// Get offset of the sample used by given vertex of given instance.
+    inline size_t Offset(uint32_t vertex_id, uint32_t instance_id) const {
+      return stride * Sample(vertex_id, instance_id);
+    }
   };
 
   /**
@@ -45,6 +114,8 @@ namespace swrast {
 
     inline const std::vector<VertexAttribute>& GetAttributes() const  { return m_attribs; }
     inline const ObjectHandle<IndexBuffer>& GetIndexBuffer() const { return m_indexBuffer.value(); }
+    /// Resolve the attributes into streams (indexed by location). This is done once per draw call.
+    std::vector<AttributeStream> GetStreams() const;
 
   private:
     std::optional<ObjectHandle<IndexBuffer>> m_indexBuffer;
@@ -8,6 +8,9 @@
 #include "state/VertexArray.h"
 #include "state/VertexBuffer.h"
 #include "state/IndexBuffer.h"
+#include "state/IndirectBuffer.h"
+#include "state/MeshOptimizer.h"
+#include "state/UniformBuffer.h"
 #include "state/Texture.h"
 #include "state/Framebuffer.h"
 #include "state/Program.h"
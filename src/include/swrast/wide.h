@@ -0,0 +1,130 @@
+/**
+ * @brief This file contains the wide (structure of arrays) types used by batched shaders.
+ * @author Jakub Kloub, xkloub03, VUT FIT
+ * @file wide.h
+ */
+#pragma once
+#include <array>
+#include <cstdint>
+#include <glm/glm.hpp>
+
+namespace swrast {
+  /// Number of lanes of the wide types.
+  constexpr uint8_t WIDE_LANES = 8;
+
+  /**
+   * @brief Float value of every lane of a batch.
+   *
+   * All operations are simple loops over the lanes, which the compiler turns into SIMD
+   * instructions of the target (2 SSE or 1 AVX operation).
+   */
+  struct alignas(32) WFloat {
+    std::array<float, WIDE_LANES> v;
+
+    WFloat() = default;
+    /// Set all lanes to the same value.
+    WFloat(float x) { v.fill(x); }
+
+    inline float& operator[](uint8_t lane) { return v[lane]; }
+    inline float operator[](uint8_t lane) const { return v[lane]; }
+
+#define SWRAST_WIDE_OP(op) \
+    inline WFloat& operator op##=(const WFloat& o) { \
+      for (uint8_t i = 0; i < WIDE_LANES; i++) v[i] op##= o.v[i]; \
+      return *this; \
+    } \
+    friend inline WFloat operator op(WFloat a, const WFloat& b) { return a op##= b; }
+    SWRAST_WIDE_OP(+)
+    SWRAST_WIDE_OP(-)
+    SWRAST_WIDE_OP(*)
+    SWRAST_WIDE_OP(/)
+#undef SWRAST_WIDE_OP
+
+    friend inline WFloat operator-(WFloat a) {
+      for (uint8_t i = 0; i < WIDE_LANES; i++) a.v[i] = -a.v[i];
+      return a;
+    }
+  };
+
+  /// Vector of N floats for every lane of a batch, stored as one WFloat per component.
+  template<int N>
+  struct WVec {
+    std::array<WFloat, N> c;
+
+    WVec() = default;
+    /// Set all lanes to the same vector.
+    WVec(const glm::vec<N, float>& x) {
+      for (int i = 0; i < N; i++) c[i] = WFloat(x[i]);
+    }
+
+    inline WFloat& operator[](int i) { return c[i]; }
+    inline const WFloat& operator[](int i) const { return c[i]; }
+
+    /// Get vector of a single lane.
+    inline glm::vec<N, float> Lane(uint8_t lane) const {
+      glm::vec<N, float> x;
+      for (int i = 0; i < N; i++) x[i] = c[i][lane];
+      return x;
+    }
+    /// Set vector of a single lane.
+    inline void SetLane(uint8_t lane, const glm::vec<N, float>& x) {
+      for (int i = 0; i < N; i++) c[i][lane] = x[i];
+    }
+
+#define SWRAST_WIDE_OP(op) \
+    inline WVec& operator op##=(const WVec& o) { for (int i = 0; i < N; i++) c[i] op##= o.c[i]; return *this; } \
+    inline WVec& operator op##=(const WFloat& o) { for (int i = 0; i < N; i++) c[i] op##= o; return *this; } \
+    friend inline WVec operator op(WVec a, const WVec& b) { return a op##= b; } \
+    friend inline WVec operator op(WVec a, const WFloat& b) { return a op##= b; }
+    SWRAST_WIDE_OP(+)
+    SWRAST_WIDE_OP(-)
+    SWRAST_WIDE_OP(*)
+    SWRAST_WIDE_OP(/)
+#undef SWRAST_WIDE_OP
+
+    friend inline WVec operator*(const WFloat& a, WVec b) { return b *= a; }
+  };
+
+  /// Get mask of the lanes where `a < b` (bit i is lane i).
+  inline uint8_t less_mask(const WFloat& a, const WFloat& b) {
+    uint8_t mask = 0;
+    for (uint8_t i = 0; i < WIDE_LANES; i++)
+      mask |= uint8_t(a.v[i] < b.v[i]) << i;
+    return mask;
+  }
+
+  /// Set value of a single lane.
+  inline void set_lane(WFloat& w, uint8_t lane, float x) { w[lane] = x; }
+  template<int N>
+  inline void set_lane(WVec<N>& w, uint8_t lane, const glm::vec<N, float>& x) { w.SetLane(lane, x); }
+
+  using WVec2 = WVec<2>;
+  using WVec3 = WVec<3>;
+  using WVec4 = WVec<4>;
+
+  /// Extend 3 component vector with given w.
+  inline WVec4 wvec4(const WVec3& v, const WFloat& w) {
+    WVec4 r;
+    r.c = { v.c[0], v.c[1], v.c[2], w };
+    return r;
+  }
+
+  /// Transform vector of every lane by the same matrix.
+  inline WVec4 operator*(const glm::mat4& m, const WVec4& v) {
+    WVec4 r;
+    for (int row = 0; row < 4; row++) {
+      WFloat& x = r.c[row];
+      for (uint8_t i = 0; i < WIDE_LANES; i++) {
+        x.v[i] = m[0][row] * v.c[0].v[i] + m[1][row] * v.c[1].v[i]
+               + m[2][row] * v.c[2].v[i] + m[3][row] * v.c[3].v[i];
+      }
+    }
+    return r;
+  }
+
+  /// Wide counterpart of the scalar type (float, glm::vec2, glm::vec3 or glm::vec4).
+  template<class T> struct WideOf;
+  template<> struct WideOf<float> { using Type = WFloat; };
+  template<int N> struct WideOf<glm::vec<N, float>> { using Type = WVec<N>; };
+  template<class T> using Wide = typename WideOf<T>::Type;
+} // namespace swrast
@@ -1,8 +1,10 @@
 #include "ren_utils/AvgSampler.hpp"
 #include "render/render.h"
+#include "render/RasterKernel.h"
 #include "camera.h"
 #include <glm/ext/matrix_clip_space.hpp>
 #include <imguiwrapper.hpp> // Requires C++20
+#include <cinttypes>
 #include <iostream>
 #include <swrast.h>
 #include <glm/gtc/matrix_transform.hpp>
@@ -11,11 +13,16 @@
 using namespace swrast;
 using namespace ImWidgets;
 
-void vertex_shader(VertexShader* vs) {
+/// Uniform block of the demo program (binding 0).
+struct Transform {
+  glm::mat4 mvp;
+};
+
+void vertex_shader(VertexContext* vs) {
   auto aPos = vs->Attribute<glm::vec3>(0).value().get();
   auto aColor = vs->Attribute<glm::vec3>(1).value().get();
   auto& color = vs->Out<glm::vec3>("color"_sid);
-  auto mvp = vs->Uniform<glm::mat4>("mvp"_sid).value().get();
+  const auto& mvp = vs->UniformBlock<Transform>(0).mvp;
 
   color = aColor;
   if (color == glm::vec3{ 0, 0, 1 })
@@ -24,7 +31,7 @@ void vertex_shader(VertexShader* vs) {
   int b = 0;
 }
 
-void fragment_shader(FragmentShader* fs) {
+void fragment_shader(FragmentContext* fs) {
   auto& color = fs->In<glm::vec3>("color"_sid);
 
   fs->m_FragColor = glm::vec4(color, 1.0f);
@@ -94,6 +101,8 @@ struct MainProgram {
     prg = State::CreateObject(Program({
       .vertex_shader = State::CreateObject(VertexShader(vertex_shader)),
       .fragment_shader = State::CreateObject(FragmentShader(fragment_shader)),
+      .varyings = { { "color"_sid, VaryingType::Vec3 } },
+      .uniform_blocks = { State::CreateObject(UniformBuffer::Create<Transform>()) },
     }));
 
     // Setup axis lines
@@ -132,6 +141,17 @@ struct MainProgram {
     ImGui::Begin("Control panel");
     ImGui::SeparatorText("Info");
     fps_plot.DrawPlot();
+    ImGui::Text("SIMD: %s", to_string(RenderState::isa));
+    ImGui::Text("Primitives: %" PRIu64 " rejected, %" PRIu64 " clipped, %" PRIu64 " small, %" PRIu64 " occluded",
+        RenderState::stats.primitives_rejected, RenderState::stats.primitives_clipped, RenderState::stats.small_triangles,
+        RenderState::stats.primitives_occluded);
+    ImGui::Text("Raster blocks: %" PRIu64 " rejected, %" PRIu64 " accepted, %" PRIu64 " partial, %" PRIu64 " occluded",
+        RenderState::stats.blocks_rejected, RenderState::stats.blocks_accepted, RenderState::stats.blocks_partial,
+        RenderState::stats.blocks_occluded);
+    ImGui::Text("Vertices shaded: %" PRIu64 " of %" PRIu64 " indices", RenderState::stats.vertices_shaded, RenderState::stats.indices_processed);
+    ImGui::Text("Fragments shaded: %" PRIu64 " (+%" PRIu64 " helpers)", RenderState::stats.fragments_shaded, RenderState::stats.helper_invocations);
+    ImGui::Text("Fragments killed by early depth test: %" PRIu64, RenderState::stats.fragments_early_killed);
+    ImGui::Text("Fragments discarded: %" PRIu64, RenderState::stats.fragments_discarded);
     ImGui::SeparatorText("Controls");
     if (ImGui::Checkbox("Depth test", &State::m_DepthTest))
       LOG_S(strfmt("Depth test: %s", State::m_DepthTest ? "on" : "off"));
@@ -149,6 +169,13 @@ struct MainProgram {
       ImGui::Unindent();
     }
     ImGui::Checkbox("Wireframe", &State::m_WriteFrame);
+    static bool fixed_point = false;
+    if (ImGui::Checkbox("Fixed point raster", &fixed_point)) {
+      State::m_RasterMode = fixed_point ? RasterMode::FixedPoint : RasterMode::Float;
+      LOG_S(strfmt("Raster mode: %s", fixed_point ? "fixed point" : "float"));
+    }
+    if (ImGui::Checkbox("Hi-Z occlusion culling", &State::m_OcclusionCulling))
+      LOG_S(strfmt("Hi-Z occlusion culling: %s", State::m_OcclusionCulling ? "on" : "off"));
     ImGui::Separator();
     ImGui::Checkbox("Rotate cube", &rotate_cube);
     if (ImGui::Button("Reset camera"))
@@ -187,14 +214,14 @@ struct MainProgram {
     State::Clear(Colors::Gray);
     prg->Use();
 
-    prg->SetUniform("mvp"_sid, glm::mat4(1.0f));
+    prg->SetUniform(Transform{ glm::mat4(1.0f) });
     State::m_DepthTest = false;
     // State::m_WriteFrame = true;
     vao->Use();
-    // State::DrawIndexed(Primitive::Triangles, vao->GetIndexBuffer()->data.size());
+    // State::DrawIndexed(Primitive::Triangles, vao->GetIndexBuffer()->Size());
     State::DrawArrays(Primitive::TriangleFan, 0, 6);
 
-    // prg->SetUniform("mvp"_sid, projection * camera.m_ViewMatrix);
+    // prg->SetUniform(Transform{ projection * camera.m_ViewMatrix });
     // axis_vao->Use();
     // State::DrawArrays(Primitive::Lines, 0, 6);
 
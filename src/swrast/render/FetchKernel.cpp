@@ -0,0 +1,46 @@
+/**
+ * @brief Implementation of render/FetchKernel.h
+ * @author Jakub Kloub, xkloub03, VUT FIT
+ * @file render/FetchKernel.cpp
+ */
+#include "render/FetchKernel.h"
+#include "wide.h"
+#include <cstring>
+#include <immintrin.h> // SIMD instructions
+
+using namespace swrast;
+
+/// Copies the sample of each lane. The size is known at compile time, so the copy is just a few moves.
+template<int N>
+void fetch_scalar(const uint8_t* data, size_t stride, const uint32_t* vertex_ids, float* out) {
+  for (uint8_t lane = 0; lane < WIDE_LANES; lane++) {
+    float x[N];
+    std::memcpy(x, data + stride * vertex_ids[lane], sizeof(x));
+    for (int c = 0; c < N; c++)
+      out[c * WIDE_LANES + lane] = x[c];
+  }
+}
+
+/// Gathers one component of all 8 lanes per instruction.
+template<int N>
+__attribute__((target("avx2")))
+void fetch_avx2(const uint8_t* data, size_t stride, const uint32_t* vertex_ids, float* out) {
+  static_assert(WIDE_LANES == 8, "One gather has to fill all the lanes");
+  // Offsets in floats. The kernel is used only when the byte offsets fit into 32 bits.
+  __m256i ids = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(vertex_ids));
+  __m256i offsets = _mm256_mullo_epi32(ids, _mm256_set1_epi32(int(stride / sizeof(float))));
+  const float* base = reinterpret_cast<const float*>(data);
+  for (int c = 0; c < N; c++)
+    _mm256_storeu_ps(out + c * WIDE_LANES, _mm256_i32gather_ps(base + c, offsets, sizeof(float)));
+}
+
+FetchKernel swrast::get_fetch_kernel(uint8_t components, bool gather, SimdIsa isa) {
+  gather = gather && isa == SimdIsa::AVX2;
+  switch (components) {
+  case 1: return gather ? fetch_avx2<1> : fetch_scalar<1>;
+  case 2: return gather ? fetch_avx2<2> : fetch_scalar<2>;
+  case 3: return gather ? fetch_avx2<3> : fetch_scalar<3>;
+  case 4: return gather ? fetch_avx2<4> : fetch_scalar<4>;
+  }
+  return nullptr;
+}
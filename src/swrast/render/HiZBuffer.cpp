@@ -0,0 +1,115 @@
+/**
+ * @brief Implementation of render/HiZBuffer.h
+ * @author Jakub Kloub, xkloub03, VUT FIT
+ * @file render/HiZBuffer.cpp
+ */
+#include "render/HiZBuffer.h"
+#include <algorithm>
+#include <atomic>
+#include <limits>
+
+using namespace swrast;
+
+// NOTE: The cells are accessed through atomic_ref, because cells of the upper levels are shared by
+//       multiple tiles, which are updated from different threads. Relaxed ordering is enough, since
+//       any value ever written is conservative.
+
+inline float load_depth(const float& cell) {
+  return std::atomic_ref<float>(const_cast<float&>(cell)).load(std::memory_order_relaxed);
+}
+
+inline void store_depth(float& cell, float value) {
+  std::atomic_ref<float>(cell).store(value, std::memory_order_relaxed);
+}
+
+HiZBuffer::HiZBuffer(glm::uvec2 size) : m_size(size) {
+  glm::uvec2 level_size = size;
+  do {
+    level_size = (level_size + glm::uvec2(CELL_SIZE - 1)) / (uint32_t)CELL_SIZE;
+    m_levels.push_back({ level_size, std::vector<float>(level_size.x * level_size.y) });
+  } while (level_size.x > 1 || level_size.y > 1);
+
+  // The depth buffer contents are unknown until it is cleared, so nothing can be occluded.
+  Clear(std::numeric_limits<float>::infinity());
+}
+
+void HiZBuffer::Clear(float depth) {
+  for (auto& level : m_levels)
+    std::fill(level.depth.begin(), level.depth.end(), depth);
+}
+
+void HiZBuffer::UpdateBlock(glm::ivec2 block, const float* depth, glm::uvec2 depth_size) {
+  if (m_levels.empty())
+    return;
+
+  // Maximum of the pixels of the block.
+  glm::uvec2 from = glm::uvec2(block);
+  glm::uvec2 to = glm::min(glm::min(from + glm::uvec2(CELL_SIZE), m_size), depth_size);
+  if (from.x >= to.x || from.y >= to.y)
+    return;
+  float max_depth = -std::numeric_limits<float>::infinity();
+  for (uint32_t y = from.y; y < to.y; y++) {
+    for (uint32_t x = from.x; x < to.x; x++)
+      max_depth = std::max(max_depth, depth[(size_t)y * depth_size.x + x]);
+  }
+
+  glm::uvec2 cell = from / (uint32_t)CELL_SIZE;
+  for (size_t l = 0; l < m_levels.size(); l++) {
+    Level& level = m_levels[l];
+    float& value = level.depth[cell.y * level.size.x + cell.x];
+    if (load_depth(value) == max_depth)
+      return;   // Nothing changed, so the levels above stay the same.
+    store_depth(value, max_depth);
+
+    if (l + 1 == m_levels.size())
+      break;
+
+    // Maximum of all cells covered by the parent cell.
+    glm::uvec2 parent = cell / (uint32_t)CELL_SIZE;
+    glm::uvec2 cfrom = parent * (uint32_t)CELL_SIZE;
+    glm::uvec2 cto = glm::min(cfrom + glm::uvec2(CELL_SIZE), level.size);
+    max_depth = -std::numeric_limits<float>::infinity();
+    for (uint32_t y = cfrom.y; y < cto.y; y++) {
+      for (uint32_t x = cfrom.x; x < cto.x; x++)
+        max_depth = std::max(max_depth, load_depth(level.depth[y * level.size.x + x]));
+    }
+    cell = parent;
+  }
+}
+
+float HiZBuffer::GetBlockDepth(glm::ivec2 block) const {
+  if (m_levels.empty())
+    return std::numeric_limits<float>::infinity();
+  const Level& level = m_levels[0];
+  glm::uvec2 cell = glm::uvec2(block) / (uint32_t)CELL_SIZE;
+  return load_depth(level.depth[cell.y * level.size.x + cell.x]);
+}
+
+float HiZBuffer::GetMaxDepth(glm::ivec2 min, glm::ivec2 max) const {
+  // Clip the area to the buffer.
+  glm::uvec2 from = glm::uvec2(glm::clamp(min, glm::ivec2(0), glm::ivec2(m_size)));
+  glm::uvec2 to = glm::uvec2(glm::clamp(max, glm::ivec2(0), glm::ivec2(m_size)));
+  if (m_levels.empty() || from.x >= to.x || from.y >= to.y)
+    return std::numeric_limits<float>::infinity();
+
+  // Find the finest level where the area spans at most 2x2 cells.
+  uint32_t cell_size = CELL_SIZE;
+  size_t l = 0;
+  glm::uvec2 cfrom, cto;
+  while (true) {
+    cfrom = from / cell_size;
+    cto = (to - glm::uvec2(1)) / cell_size + glm::uvec2(1);
+    if ((cto.x - cfrom.x <= 2 && cto.y - cfrom.y <= 2) || l + 1 == m_levels.size())
+      break;
+    cell_size *= CELL_SIZE;
+    l++;
+  }
+
+  const Level& level = m_levels[l];
+  float max_depth = -std::numeric_limits<float>::infinity();
+  for (uint32_t y = cfrom.y; y < cto.y; y++) {
+    for (uint32_t x = cfrom.x; x < cto.x; x++)
+      max_depth = std::max(max_depth, load_depth(level.depth[y * level.size.x + x]));
+  }
+  return max_depth;
+}
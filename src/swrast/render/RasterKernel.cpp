@@ -0,0 +1,171 @@
+/**
+ * @brief Implementation of render/RasterKernel.h
+ * @author Jakub Kloub, xkloub03, VUT FIT
+ * @file render/RasterKernel.cpp
+ */
+#include "render/RasterKernel.h"
+#include <immintrin.h> // SIMD instructions
+#include <stdexcept>
+
+using namespace swrast;
+
+// NOTE: The SIMD kernels evaluate the edge functions with exactly the same sequence of operations
+//       as EdgeFunc::operator(), so they are bit-exact with the scalar kernel. This file is built
+//       with -ffp-contract=off (see src/meson.build), because FMA would change the rounding.
+
+/// Reference implementation testing the pixels one by one.
+uint64_t coverage_scalar(const EdgeFunc (&edges)[3], glm::ivec2 block) {
+  uint64_t mask = 0;
+  for (int y = 0; y < RASTER_BLOCK; y++) {
+    float py = (float)(block.y + y) + 0.5f;
+    for (int x = 0; x < RASTER_BLOCK; x++) {
+      float px = (float)(block.x + x) + 0.5f;
+      if (edges[0](px, py) >= 0 && edges[1](px, py) >= 0 && edges[2](px, py) >= 0)
+        mask |= uint64_t(1) << (y * RASTER_BLOCK + x);
+    }
+  }
+  return mask;
+}
+
+/// Evaluates 4 pixels per step, so each row of the block takes two steps.
+uint64_t coverage_sse2(const EdgeFunc (&edges)[3], glm::ivec2 block) {
+  const __m128 lanes = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 px[2] = {
+    _mm_add_ps(_mm_set1_ps((float)block.x), lanes),
+    _mm_add_ps(_mm_set1_ps((float)(block.x + 4)), lanes),
+  };
+
+  // The x part of the edge functions is the same for every row.
+  __m128 ex[3][2];
+  for (int e = 0; e < 3; e++) {
+    for (int h = 0; h < 2; h++)
+      ex[e][h] = _mm_mul_ps(_mm_sub_ps(px[h], _mm_set1_ps(edges[e].v.x)), _mm_set1_ps(edges[e].d.y));
+  }
+
+  uint64_t mask = 0;
+  for (int y = 0; y < RASTER_BLOCK; y++) {
+    float py = (float)(block.y + y) + 0.5f;
+    __m128 ey[3];
+    for (int e = 0; e < 3; e++)
+      ey[e] = _mm_set1_ps((py - edges[e].v.y) * edges[e].d.x);
+
+    for (int h = 0; h < 2; h++) {
+      __m128 in = _mm_cmpge_ps(_mm_sub_ps(ey[0], ex[0][h]), zero);
+      in = _mm_and_ps(in, _mm_cmpge_ps(_mm_sub_ps(ey[1], ex[1][h]), zero));
+      in = _mm_and_ps(in, _mm_cmpge_ps(_mm_sub_ps(ey[2], ex[2][h]), zero));
+      mask |= uint64_t(_mm_movemask_ps(in)) << (y * RASTER_BLOCK + h * 4);
+    }
+  }
+  return mask;
+}
+
+/// Evaluates whole row of the block (8 pixels) per step.
+__attribute__((target("avx2")))
+uint64_t coverage_avx2(const EdgeFunc (&edges)[3], glm::ivec2 block) {
+  const __m256 lanes = _mm256_setr_ps(0.5f, 1.5f, 2.5f, 3.5f, 4.5f, 5.5f, 6.5f, 7.5f);
+  const __m256 zero = _mm256_setzero_ps();
+  const __m256 px = _mm256_add_ps(_mm256_set1_ps((float)block.x), lanes);
+
+  // The x part of the edge functions is the same for every row.
+  __m256 ex[3];
+  for (int e = 0; e < 3; e++)
+    ex[e] = _mm256_mul_ps(_mm256_sub_ps(px, _mm256_set1_ps(edges[e].v.x)), _mm256_set1_ps(edges[e].d.y));
+
+  uint64_t mask = 0;
+  for (int y = 0; y < RASTER_BLOCK; y++) {
+    float py = (float)(block.y + y) + 0.5f;
+    __m256 in = _mm256_cmp_ps(_mm256_sub_ps(_mm256_set1_ps((py - edges[0].v.y) * edges[0].d.x), ex[0]), zero, _CMP_GE_OQ);
+    in = _mm256_and_ps(in, _mm256_cmp_ps(_mm256_sub_ps(_mm256_set1_ps((py - edges[1].v.y) * edges[1].d.x), ex[1]), zero, _CMP_GE_OQ));
+    in = _mm256_and_ps(in, _mm256_cmp_ps(_mm256_sub_ps(_mm256_set1_ps((py - edges[2].v.y) * edges[2].d.x), ex[2]), zero, _CMP_GE_OQ));
+    mask |= uint64_t(_mm256_movemask_ps(in)) << (y * RASTER_BLOCK);
+  }
+  return mask;
+}
+
+/// Reference fixed point implementation. Steps the edge functions pixel by pixel.
+uint64_t coverage_fixed_scalar(const FixedEdgeFunc (&edges)[3], glm::ivec2 block) {
+  int64_t row[3];
+  for (int e = 0; e < 3; e++)
+    row[e] = edges[e].At(block.x, block.y);
+
+  uint64_t mask = 0;
+  for (int y = 0; y < RASTER_BLOCK; y++) {
+    int64_t t[3] = { row[0], row[1], row[2] };
+    for (int x = 0; x < RASTER_BLOCK; x++) {
+      if ((t[0] | t[1] | t[2]) >= 0)   // None of the values is negative.
+        mask |= uint64_t(1) << (y * RASTER_BLOCK + x);
+      for (int e = 0; e < 3; e++)
+        t[e] += edges[e].dx;
+    }
+    for (int e = 0; e < 3; e++)
+      row[e] += edges[e].dy;
+  }
+  return mask;
+}
+
+/// Evaluates 4 pixels per step using 64-bit integer lanes, so each row takes two steps.
+__attribute__((target("avx2")))
+uint64_t coverage_fixed_avx2(const FixedEdgeFunc (&edges)[3], glm::ivec2 block) {
+  // Offsets of the lanes from the start of the row for both halves of the row.
+  __m256i lanes[3][2];
+  __m256i row[3];
+  for (int e = 0; e < 3; e++) {
+    int64_t dx = edges[e].dx;
+    lanes[e][0] = _mm256_setr_epi64x(0, dx, 2 * dx, 3 * dx);
+    lanes[e][1] = _mm256_add_epi64(lanes[e][0], _mm256_set1_epi64x(4 * dx));
+    row[e] = _mm256_set1_epi64x(edges[e].At(block.x, block.y));
+  }
+
+  uint64_t mask = 0;
+  for (int y = 0; y < RASTER_BLOCK; y++) {
+    for (int h = 0; h < 2; h++) {
+      __m256i t = _mm256_or_si256(
+        _mm256_or_si256(_mm256_add_epi64(row[0], lanes[0][h]), _mm256_add_epi64(row[1], lanes[1][h])),
+        _mm256_add_epi64(row[2], lanes[2][h])
+      );
+      // Sign bits of the lanes tell us which pixels are outside of some edge.
+      uint64_t outside = _mm256_movemask_pd(_mm256_castsi256_pd(t));
+      mask |= (~outside & 0xf) << (y * RASTER_BLOCK + h * 4);
+    }
+    for (int e = 0; e < 3; e++)
+      row[e] = _mm256_add_epi64(row[e], _mm256_set1_epi64x(edges[e].dy));
+  }
+  return mask;
+}
+
+SimdIsa swrast::detect_simd_isa() {
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return SimdIsa::AVX2;
+  if (__builtin_cpu_supports("sse2"))
+    return SimdIsa::SSE2;
+  return SimdIsa::Scalar;
+}
+
+const char* swrast::to_string(SimdIsa isa) {
+  switch (isa) {
+  case SimdIsa::Scalar: return "Scalar";
+  case SimdIsa::SSE2: return "SSE2";
+  case SimdIsa::AVX2: return "AVX2";
+  }
+  throw std::invalid_argument("to_string: Invalid SimdIsa");
+}
+
+CoverageKernel swrast::get_coverage_kernel(SimdIsa isa) {
+  switch (isa) {
+  case SimdIsa::Scalar: return coverage_scalar;
+  case SimdIsa::SSE2: return coverage_sse2;
+  case SimdIsa::AVX2: return coverage_avx2;
+  }
+  throw std::invalid_argument("get_coverage_kernel: Invalid SimdIsa");
+}
+
+FixedCoverageKernel swrast::get_fixed_coverage_kernel(SimdIsa isa) {
+  switch (isa) {
+  case SimdIsa::Scalar: return coverage_fixed_scalar;
+  case SimdIsa::SSE2: return coverage_fixed_scalar;
+  case SimdIsa::AVX2: return coverage_fixed_avx2;
+  }
+  throw std::invalid_argument("get_fixed_coverage_kernel: Invalid SimdIsa");
+}
@@ -4,15 +4,16 @@
  * @file RenderPrimitive.cpp
  */
 #include "render/render.h"
+#include "render/HiZBuffer.h"
 #include "render/RenderPrimitive.h"
+#include "render/RasterKernel.h"
 #include "state/Framebuffer.h"
 #include "state/Program.h"
-#include <immintrin.h> // SIMD instructions
-#include <glm/gtc/type_ptr.hpp>
+#include <bit>
 
 using namespace swrast;
 
-void bresenham_line(glm::ivec2 a, glm::ivec2 b, const RenderPrimitive::FragFunc& func) {
+void bresenham_line(glm::ivec2 a, glm::ivec2 b, const RenderPrimitive::FragFunc& func, const ScreenRect& rect) {
   glm::ivec2 u = b - a;
   bool flip_x = false;
   bool flip_y = false;
@@ -33,8 +34,20 @@ void bresenham_line(glm::ivec2 a, glm::ivec2 b, const RenderPrimitive::FragFunc&
   int x = a.x, y = a.y;
   int e = 0.5f * (u.x - u.y);
 
+  // The line is monotonic, so it never returns to a raster block it left. Its pixels are merged
+  // into one block per raster block.
+  FragmentBlock block{ glm::ivec2(0), 0, false };
   while (x <= b.x && y <= b.y) {
-    func(glm::vec4((flip_x ? -x : x) + 0.5f, (flip_y ? -y : y) + 0.5f, 0.0f, 1.0f));
+    glm::ivec2 p = { flip_x ? -x : x, flip_y ? -y : y };
+    if (p.x >= rect.min.x && p.y >= rect.min.y && p.x < rect.max.x && p.y < rect.max.y) {
+      glm::ivec2 offset = p % RASTER_BLOCK;
+      if (block.mask && block.origin != p - offset) {
+        func(block);
+        block.mask = 0;
+      }
+      block.origin = p - offset;
+      block.mask |= uint64_t(1) << (offset.y * RASTER_BLOCK + offset.x);
+    }
     if (e < 0) {
       y++;
       e += u.x;
@@ -43,43 +56,69 @@ void bresenham_line(glm::ivec2 a, glm::ivec2 b, const RenderPrimitive::FragFunc&
       e -= u.y;
     }
   }
+  if (block.mask)
+    func(block);
 }
 
-inline glm::vec4 simd_interp(const glm::vec4& a, const glm::vec4& b, const glm::vec4& c, const glm::vec3& p) {
-  __m128 va = _mm_loadu_ps(glm::value_ptr(a));
-  __m128 vb = _mm_loadu_ps(glm::value_ptr(b));
-  __m128 vc = _mm_loadu_ps(glm::value_ptr(c));
-
-  __m128 vpx = _mm_set_ps(p.x, p.x, p.x, p.x);
-  __m128 vpy = _mm_set_ps(p.y, p.y, p.y, p.y);
-  __m128 vpz = _mm_set_ps(p.z, p.z, p.z, p.z);
+/// Get plane of values `f0`, `f1`, `f2` at the triangle vertices. `e1`, `e2` are edges going from the first vertex.
+template<class T>
+PlaneEq<T> triangle_plane(const T& f0, const T& f1, const T& f2, glm::vec2 e1, glm::vec2 e2, float inv_area) {
+  T d1 = f1 - f0;
+  T d2 = f2 - f0;
+  return { f0, (d1 * e2.y - d2 * e1.y) * inv_area, (d2 * e1.x - d1 * e2.x) * inv_area };
+}
 
-  __m128 result = _mm_add_ps(_mm_add_ps(_mm_mul_ps(vpx, va), _mm_mul_ps(vpy, vb)), _mm_mul_ps(vpz, vc));
+/// Get plane of values `f0`, `f1` at the line end points. `g` is the gradient of the line parameter.
+template<class T>
+PlaneEq<T> line_plane(const T& f0, const T& f1, glm::vec2 g) {
+  T d = f1 - f0;
+  return { f0, d * g.x, d * g.y };
+}
 
-  glm::vec4 v_result;
-  _mm_storeu_ps(glm::value_ptr(v_result), result);
+void RasterPrimitive::Interpolate(FragmentBatch& batch) const {
+  WFloat x = batch.m_FragCoord[0] - plane_origin.x;
+  WFloat y = batch.m_FragCoord[1] - plane_origin.y;
+
+  // Perspective correction.
+  WFloat w = 1.0f / inv_w_plane.At(x, y);
+  auto& vars = batch.InVars();
+  for (uint8_t i = 0; i < var_count; i++) {
+    const VarPlane& var = var_planes[i];
+    if (var.integer) {
+      vars[i] = WVec4(var.flat.f4);
+      continue;
+    }
+    for (int c = 0; c < 4; c++) {
+      PlaneEq<float> plane = { var.plane.c[c], var.plane.dx[c], var.plane.dy[c] };
+      vars[i][c] = plane.At(x, y) * w;
+    }
+  }
 
-  return v_result;
+  batch.m_FragCoord[2] = depth_plane.At(x, y);
 }
 
-
 TrianglePrimitive::TrianglePrimitive(const std::array<Vertex, 3>& vertices)
   : m_prim(Primitive::Triangles)
-  , m_Vertices(vertices) {
-  auto ac = c - a;
-  auto ab = b - a;
-  m_invArea = 1.0f / glm::abs(ac.x * ab.y - ac.y * ab.x);
+  , m_Vertices(vertices) {}
+
+TrianglePrimitive::TrianglePrimitive(const TrianglePrimitive& other)
+  : RenderPrimitive(other)
+  , m_currentVertex(other.m_currentVertex)
+  , m_prim(other.m_prim)
+  , m_posBackup(other.m_posBackup)
+  , m_even(other.m_even)
+  , m_Vertices(other.m_Vertices) {}
+
+/// Round the coordinate to the fixed point sub-pixel grid.
+inline float snap_to_subpixel(float x) {
+  return std::round(x * SUBPIXEL_ONE) / SUBPIXEL_ONE;
 }
 
-void TrianglePrimitive::ProcessVertex(glm::vec4& position) {
+void TrianglePrimitive::ProcessVertex(const glm::vec4& position, const Shader::InOutVars& vars) {
   m_Vertices[m_currentVertex].pos = position;
-  m_Vertices[m_currentVertex].vars = RenderState::ctx.prg->GetVertexShader()->OutVars();
+  m_Vertices[m_currentVertex].vars = vars;
 
   if (++m_currentVertex == 3) {
-    auto ac = c - a;
-    auto ab = b - a;
-    m_invArea = 1.0f / glm::abs(ac.x * ab.y - ac.y * ab.x);
-
     switch (m_prim) {
       case Primitive::TriangleStrip:
         m_posBackup[0] = m_Vertices[1].pos;
@@ -114,7 +153,6 @@ void TrianglePrimitive::ProcessVertex(glm::vec4& position) {
 
 void TrianglePrimitive::Reset() {
   m_currentVertex = 0;
-  m_prim = Primitive::Triangles;
   m_even = true;
 }
 
@@ -124,64 +162,91 @@ inline bool is_ccw(const TrianglePrimitive& prim) {
   return ac.x * ab.y - ac.y * ab.x <= 0.0f;
 }
 
-void TrianglePrimitive::Clip(const PrimFunc& func)  {
-  std::array<uint8_t, 3> pi = { 0, 1, 2 };
+/// Planes of the view frustum in the homogeneous clip space.
+enum ClipPlane : uint8_t { Near, Far, Left, Right, Bottom, Top, CLIP_PLANE_COUNT };
 
-  // Sort the vertices by z, so we can easily decide situation.
-  std::sort(pi.begin(), pi.end(), [this](uint8_t a, uint8_t b) {
-      return m_Vertices[a].pos.z < m_Vertices[b].pos.z;
-  });
+/**
+ * @brief Get signed distance of the point from the clip plane. Point is inside when it isn't negative.
+ * @param guard_band Scale of the side planes. Use 1 to get the exact view frustum.
+ */
+inline float clip_distance(const glm::vec4& p, uint8_t plane, float guard_band) {
+  switch (plane) {
+  case ClipPlane::Near: return p.z + p.w;
+  case ClipPlane::Far: return p.w - p.z;
+  case ClipPlane::Left: return p.x + guard_band * p.w;
+  case ClipPlane::Right: return guard_band * p.w - p.x;
+  case ClipPlane::Bottom: return p.y + guard_band * p.w;
+  default: return guard_band * p.w - p.y;
+  }
+}
 
-  // Decide the position situation between primitive and near plane.
-  uint8_t situation = 0;
-  situation |= uint8_t(m_Vertices[0].pos.z >= -m_Vertices[0].pos.w) << 2;
-  situation |= uint8_t(m_Vertices[1].pos.z >= -m_Vertices[1].pos.w) << 1;
-  situation |= uint8_t(m_Vertices[2].pos.z >= -m_Vertices[2].pos.w) << 0;
+/// Get mask of the clip planes the point is outside of.
+inline uint8_t clip_outcode(const glm::vec4& p, float guard_band) {
+  uint8_t code = 0;
+  for (uint8_t plane = 0; plane < CLIP_PLANE_COUNT; plane++)
+    code |= uint8_t(clip_distance(p, plane, guard_band) < 0.0f) << plane;
+  return code;
+}
 
-  // Early exit for primitives entirely before/behind near plane.
-  if (situation == 7) {   // All vertices behind near plane.
-    func(this);
-    return;
-  } else if (situation == 0)   // All vertices before near plane.
+/// Get vertex between `a` (t = 0) and `b` (t = 1).
+Vertex lerp_vertex(const Vertex& a, const Vertex& b, float t) {
+  const VaryingLayout& layout = RenderState::ctx.prg->GetVaryingLayout();
+  Vertex x;
+  x.pos = (1.0f - t) * a.pos + t * b.pos;
+  for (uint8_t i = 0; i < layout.Size(); i++) {
+    if (is_integer(layout[i].type))
+      x.vars[i] = a.vars[i];
+    else
+      x.vars[i].f4 = (1.0f - t) * a.vars[i].f4 + t * b.vars[i].f4;
+  }
+  return x;
+}
+
+void TrianglePrimitive::Clip(const PrimFunc& func) {
+  // Trivial reject, when all vertices are outside of the same frustum plane.
+  if (clip_outcode(a, 1.0f) & clip_outcode(b, 1.0f) & clip_outcode(c, 1.0f)) {
+    RenderStats::Add(RenderState::stats.primitives_rejected, 1);
     return;
+  }
 
-  // Split edge with near plane and return the interpolated intersection OutVertex.
-  const auto& cut_edge = [](Vertex& a, Vertex& b) -> Vertex {
-    float t = (a.pos.z + a.pos.w) / (a.pos.z - b.pos.z + a.pos.w - b.pos.w);
-    Vertex x;
-    x.pos = (1.0f - t) * a.pos + t * b.pos;
-    // Interpolate the cutted edge points.
-    for (auto& [name, var] : a.vars) {
-      if (var.integer)
-        x.vars[name] = var;
-      else
-        x.vars[name].f4 = (1 - t) * a.vars[name].f4 + t * b.vars[name].f4;
+  // Trivial accept, when the triangle is in the guard band. The rasterizer scissors it to the screen.
+  const float guard_band = RenderState::ctx.guard_band;
+  uint8_t crossed = clip_outcode(a, guard_band) | clip_outcode(b, guard_band) | clip_outcode(c, guard_band);
+  if (crossed == 0) {
+    func(this);
+    return;
+  }
+  RenderStats::Add(RenderState::stats.primitives_clipped, 1);
+
+  // Sutherland-Hodgman clipping against the planes crossed by the triangle.
+  std::vector<Vertex> poly(m_Vertices.begin(), m_Vertices.end());
+  std::vector<Vertex> clipped;
+  for (uint8_t plane = 0; plane < CLIP_PLANE_COUNT; plane++) {
+    if (!(crossed & (1 << plane)))
+      continue;
+
+    clipped.clear();
+    for (size_t i = 0; i < poly.size(); i++) {
+      const Vertex& cur = poly[i];
+      const Vertex& next = poly[(i + 1) % poly.size()];
+      float dc = clip_distance(cur.pos, plane, guard_band);
+      float dn = clip_distance(next.pos, plane, guard_band);
+      if (dc >= 0.0f)
+        clipped.push_back(cur);
+      if ((dc >= 0.0f) != (dn >= 0.0f))
+        clipped.push_back(lerp_vertex(cur, next, dc / (dc - dn)));
     }
-    return x;
-  };
-
-  if (situation == 3) {   // First vertex before near plane.
-    Shader::InOutVars i1_attrs, i2_attrs;
-    Vertex i1 = cut_edge(m_Vertices[1], m_Vertices[0]);
-    Vertex i2 = cut_edge(m_Vertices[2], m_Vertices[0]);
+    std::swap(poly, clipped);
+    if (poly.size() < 3)
+      return;
+  }
 
-    auto p1 = TrianglePrimitive({ m_Vertices[1], i1, i2 });
-    auto p2 = TrianglePrimitive({ m_Vertices[1], i2, m_Vertices[2] });
-    if (is_ccw(*this) ^ is_ccw(p1)) {
-      std::swap(p1.m_Vertices[1], p1.m_Vertices[2]);
-      std::swap(p2.m_Vertices[1], p2.m_Vertices[2]);
-    }
-    func(&p1);
-    func(&p2);
-  } else if (situation == 1) {   // First two vertices before near plane.
-    auto p1 = TrianglePrimitive({
-        cut_edge(m_Vertices[2], m_Vertices[1]),
-        cut_edge(m_Vertices[2], m_Vertices[0]),
-        m_Vertices[2]
-    });
-    if (is_ccw(*this) ^ is_ccw(p1))
-      std::swap(p1.m_Vertices[1], p1.m_Vertices[2]);
-    func(&p1);
+  // Triangulate the clipped polygon as a fan. This keeps the winding of the original triangle.
+  for (size_t i = 1; i + 1 < poly.size(); i++) {
+    TrianglePrimitive prim({ poly[0], poly[i], poly[i + 1] });
+    prim.m_prim = m_prim;
+    prim.m_even = m_even;
+    func(&prim);
   }
 }
 
@@ -208,6 +273,14 @@ void TrianglePrimitive::NdcTransform() {
 
   c.x = (c.x + 1) * RenderState::ctx.fb->GetSize().x * 0.5f;
   c.y = (c.y + 1) * RenderState::ctx.fb->GetSize().y * 0.5f;
+
+  // Snap the vertices to the sub-pixel grid, so interpolation uses the same positions as rasterization.
+  if (RenderState::ctx.raster == RasterMode::FixedPoint) {
+    for (auto* v : { &a, &b, &c }) {
+      v->x = snap_to_subpixel(v->x);
+      v->y = snap_to_subpixel(v->y);
+    }
+  }
 }
 
 bool TrianglePrimitive::Cull() {
@@ -227,44 +300,258 @@ bool TrianglePrimitive::Cull() {
   return !is_ccw(*this);
 }
 
-// Implementation of Pineda's rasterization algorithm.
-void TrianglePrimitive::rasterize(const FragFunc& func) {
-  glm::vec2 v[] = { glm::vec2(a), glm::vec2(b), glm::vec2(c) };
+ScreenRect TrianglePrimitive::GetBounds() const {
+  glm::vec2 bmin = glm::floor(glm::min(glm::min(glm::vec2(a), glm::vec2(b)), glm::vec2(c)));
+  glm::vec2 bmax = glm::ceil(glm::max(glm::max(glm::vec2(a), glm::vec2(b)), glm::vec2(c)));
+  return { glm::ivec2(bmin), glm::ivec2(bmax) };
+}
+
+enum class BlockCoverage : uint8_t { Outside, Partial, Inside };
 
+/**
+ * @brief Classify a 8x8 block of pixels against the triangle edges.
+ *
+ * Edge functions are linear, so their extremes over the block are at the corner pixel centers.
+ * If all corners are outside of some edge, the whole block is outside. If all corners are inside
+ * of every edge, the whole block is inside.
+ * @tparam Edge EdgeFunc or FixedEdgeFunc
+ */
+template<class Edge>
+inline BlockCoverage classify_block(const Edge (&edges)[3], glm::ivec2 block) {
+  int x0 = block.x, x1 = block.x + RASTER_BLOCK - 1;
+  int y0 = block.y, y1 = block.y + RASTER_BLOCK - 1;
+  bool inside = true;
+  for (const auto& e : edges) {
+    auto c00 = e.At(x0, y0), c10 = e.At(x1, y0), c01 = e.At(x0, y1), c11 = e.At(x1, y1);
+    auto cmin = std::min(std::min(c00, c10), std::min(c01, c11));
+    auto cmax = std::max(std::max(c00, c10), std::max(c01, c11));
+    if (cmax < 0)
+      return BlockCoverage::Outside;
+    inside &= cmin >= 0;
+  }
+  return inside ? BlockCoverage::Inside : BlockCoverage::Partial;
+}
+
+/// Get mask of pixels of the 8x8 block which are inside of the area <from, to).
+inline uint64_t area_mask(glm::ivec2 block, glm::ivec2 from, glm::ivec2 to) {
+  uint64_t row = ((uint64_t(1) << (to.x - block.x)) - 1) & ~((uint64_t(1) << (from.x - block.x)) - 1);
+  uint64_t mask = 0;
+  for (int y = from.y - block.y; y < to.y - block.y; y++)
+    mask |= row << (y * RASTER_BLOCK);
+  return mask;
+}
+
+/**
+ * @brief Go over the screen aligned 8x8 blocks of the area and emit covered pixels.
+ *
+ * Fully covered blocks are emitted at once and empty blocks are skipped. Only partially covered
+ * blocks are tested pixel by pixel using the SIMD kernel. Blocks are aligned to the screen (not to
+ * the area), so the coverage is the same regardless of the tiling.
+ * @param edges Edge functions of the triangle.
+ * @param coverage Kernel used for partially covered blocks.
+ * @param occluded Predicate telling if the block is hidden by the depth buffer contents.
+ * @param imin Top-left corner of the area.
+ * @param imax Bottom-right corner of the area (exclusive).
+ * @param func Function called for each block with at least one covered pixel.
+ */
+template<class Edge, class Kernel, class Occluded>
+void rasterize_blocks(
+  const Edge (&edges)[3], Kernel coverage, const Occluded& occluded,
+  glm::ivec2 imin, glm::ivec2 imax, const RenderPrimitive::FragFunc& func
+) {
+  uint64_t rejected = 0, accepted = 0, partial = 0, hidden = 0;
+  glm::ivec2 start = (imin / RASTER_BLOCK) * RASTER_BLOCK;
+  for (int by = start.y; by < imax.y; by += RASTER_BLOCK) {
+    for (int bx = start.x; bx < imax.x; bx += RASTER_BLOCK) {
+      glm::ivec2 block = { bx, by };
+      glm::ivec2 from = glm::max(block, imin);
+      glm::ivec2 to = glm::min(block + RASTER_BLOCK, imax);
+
+      uint64_t mask = 0;
+      BlockCoverage cov = classify_block(edges, block);
+      if (cov == BlockCoverage::Outside) {
+        rejected++;
+        continue;
+      }
+      if (occluded(block)) {
+        hidden++;
+        continue;
+      }
+
+      if (cov == BlockCoverage::Inside) {
+        accepted++;
+        mask = area_mask(block, from, to);
+      } else {
+        partial++;
+        mask = coverage(edges, block) & area_mask(block, from, to);
+      }
+
+      // NOTE: Fragment depth is added in fragment_interpolate().
+      if (mask)
+        func({ block, mask });
+    }
+  }
+
+  RenderStats::Add(RenderState::stats.blocks_rejected, rejected);
+  RenderStats::Add(RenderState::stats.blocks_accepted, accepted);
+  RenderStats::Add(RenderState::stats.blocks_partial, partial);
+  RenderStats::Add(RenderState::stats.blocks_occluded, hidden);
+}
+
+/// Vertices further from the origin than this (in pixels) don't fit into the fixed point edge functions.
+constexpr float FIXED_POINT_LIMIT = 1 << 14;
+
+/**
+ * @brief Set up fixed point edge function of edge going from `v0` to `v1`.
+ *
+ * Pixels lying exactly on the edge are owned by the edge only if it is a top or left edge. With
+ * the CCW orientation used here (y axis pointing up) top edges go in -x direction and left edges
+ * go in -y direction. Every edge shared by two triangles is traversed in opposite directions by
+ * them, so exactly one of the triangles owns the pixels on it.
+ */
+inline FixedEdgeFunc setup_fixed_edge(glm::i64vec2 v0, glm::i64vec2 v1) {
+  glm::i64vec2 d = v1 - v0;
+  bool top_left = d.y < 0 || (d.y == 0 && d.x < 0);
+  const int64_t half = SUBPIXEL_ONE / 2;
+
+  // E(x, y) = (py - v0.y) * d.x - (px - v0.x) * d.y, where p is the pixel center in fixed point.
+  return {
+    .c = (half - v0.y) * d.x - (half - v0.x) * d.y - (top_left ? 0 : 1),
+    .dx = -SUBPIXEL_ONE * d.y,
+    .dy = SUBPIXEL_ONE * d.x,
+  };
+}
+
+/// Check if the triangle with given bounding box can use the fixed point edge functions.
+inline bool use_fixed_point(glm::vec2 bmin, glm::vec2 bmax) {
+  return RenderState::ctx.raster == RasterMode::FixedPoint
+    && glm::max(glm::abs(bmin.x), glm::abs(bmin.y)) < FIXED_POINT_LIMIT
+    && glm::max(glm::abs(bmax.x), glm::abs(bmax.y)) < FIXED_POINT_LIMIT;
+}
+
+/// Set up the float edge functions of the triangle (converted to CCW order).
+void setup_edges(glm::vec2 v0, glm::vec2 v1, glm::vec2 v2, EdgeFunc (&edges)[3]) {
   // If the vertices aren't in CCW order, then convert them to CCW.
-  glm::vec2 ab = v[1] - v[0];
-  glm::vec2 ac = v[2] - v[0];
+  glm::vec2 ab = v1 - v0;
+  glm::vec2 ac = v2 - v0;
   if (ac.x * ab.y - ac.y * ab.x >= 0.0f)
-    std::swap(v[1], v[2]);
+    std::swap(v1, v2);
+
+  edges[0] = { v0, v1 - v0 };
+  edges[1] = { v1, v2 - v1 };
+  edges[2] = { v2, v0 - v2 };
+}
+
+/**
+ * @brief Set up the fixed point edge functions of the triangle (converted to CCW order).
+ * @return False for degenerate triangles, which cover no pixels.
+ */
+bool setup_edges(glm::vec2 v0, glm::vec2 v1, glm::vec2 v2, FixedEdgeFunc (&edges)[3]) {
+  // Vertices are already snapped in NdcTransform(), so the conversion is exact.
+  glm::i64vec2 f[] = {
+    glm::i64vec2(v0 * float(SUBPIXEL_ONE)),
+    glm::i64vec2(v1 * float(SUBPIXEL_ONE)),
+    glm::i64vec2(v2 * float(SUBPIXEL_ONE)),
+  };
+
+  int64_t area = (f[1].x - f[0].x) * (f[2].y - f[0].y) - (f[1].y - f[0].y) * (f[2].x - f[0].x);
+  if (area == 0)
+    return false;
+  if (area < 0)
+    std::swap(f[1], f[2]);
+
+  edges[0] = setup_fixed_edge(f[0], f[1]);
+  edges[1] = setup_fixed_edge(f[1], f[2]);
+  edges[2] = setup_fixed_edge(f[2], f[0]);
+  return true;
+}
+
+/// Maximum width and height (in pixels) of bounding box of triangles using the small triangle path.
+constexpr int SMALL_TRIANGLE_SIZE = 2;
+
+/**
+ * @brief Test the candidate pixels of a small triangle directly.
+ * @param min Top-left pixel of the bounding box.
+ * @param size Size of the bounding box (at most SMALL_TRIANGLE_SIZE).
+ * @return Mask with bit `y * SMALL_TRIANGLE_SIZE + x` set for covered pixel `min + (x, y)`.
+ */
+template<class Edge>
+uint8_t small_coverage(const Edge (&edges)[3], glm::ivec2 min, glm::ivec2 size) {
+  uint8_t mask = 0;
+  for (int y = 0; y < size.y; y++) {
+    for (int x = 0; x < size.x; x++) {
+      int px = min.x + x, py = min.y + y;
+      if (edges[0].At(px, py) >= 0 && edges[1].At(px, py) >= 0 && edges[2].At(px, py) >= 0)
+        mask |= 1 << (y * SMALL_TRIANGLE_SIZE + x);
+    }
+  }
+  return mask;
+}
+
+/// Rasterize the filled triangle.
+void rasterize_triangle(const RasterPrimitive& prim, const RasterPrimitive::FragFunc& func, const ScreenRect& rect) {
+  // Coverage of small triangles is already known from Setup().
+  if (prim.small) {
+    FragmentBlock block{ glm::ivec2(0), 0 };
+    for (uint8_t mask = prim.small_mask; mask; mask &= mask - 1) {
+      int bit = std::countr_zero(mask);
+      glm::ivec2 p = prim.small_min + glm::ivec2(bit % SMALL_TRIANGLE_SIZE, bit / SMALL_TRIANGLE_SIZE);
+      if (p.x < rect.min.x || p.y < rect.min.y || p.x >= rect.max.x || p.y >= rect.max.y)
+        continue;
+
+      // Merge the pixels of the same raster block, so they are shaded in the same quads.
+      glm::ivec2 offset = p % RASTER_BLOCK;
+      if (block.mask && block.origin != p - offset) {
+        func(block);
+        block.mask = 0;
+      }
+      block.origin = p - offset;
+      block.mask |= uint64_t(1) << (offset.y * RASTER_BLOCK + offset.x);
+    }
+    if (block.mask)
+      func(block);
+    return;
+  }
+
+  // Implementation of Pineda's rasterization algorithm with hierarchical block traversal.
+  glm::vec2 v[] = { glm::vec2(prim.pos[0]), glm::vec2(prim.pos[1]), glm::vec2(prim.pos[2]) };
 
   // Compute bounding box for this primitive
   glm::vec2 bmin = glm::floor(glm::min(glm::min(v[0], v[1]), v[2]));
   glm::vec2 bmax = glm::ceil(glm::max(glm::max(v[0], v[1]), v[2]));
 
-  // Clip the bounding box to the size of the framebuffer.
-  bmin = glm::max({ 0.0f, 0.0f }, bmin);
-  bmax = glm::min(glm::vec2(RenderState::ctx.fb->GetSize()), bmax);
-
-  // Compute the edge vectors and functions.
-  glm::vec2 d1 = v[1] - v[0];
-  glm::vec2 d2 = v[2] - v[1];
-  glm::vec2 d3 = v[0] - v[2];
-  float e1 = (bmin.y - v[0].y + 0.5f) * d1.x - (bmin.x - v[0].x + 0.5f) * d1.y;
-  float e2 = (bmin.y - v[1].y + 0.5f) * d2.x - (bmin.x - v[1].x + 0.5f) * d2.y;
-  float e3 = (bmin.y - v[2].y + 0.5f) * d3.x - (bmin.x - v[2].x + 0.5f) * d3.y;
-
-  // Go over every pixel in bounding box and call `func` if inside triangle.
-  // TODO: Optimization as mentioned in presentation.
-  for (int y = bmin.y; y < (int)bmax.y; y++) {
-    float t1 = e1, t2 = e2, t3 = e3;
-    for (int x = bmin.x; x < (int)bmax.x; x++) {
-      if (t1 >= 0 && t2 >= 0 && t3 >= 0) {
-        func(glm::vec4((float)x + 0.5f, (float)y + 0.5f, 0.0f, 1.0f));   // NOTE: Fragment depth is added in fragment_interpolate().
-      }
-      t1 -= d1.y; t2 -= d2.y; t3 -= d3.y;
-    }
-    e1 += d1.x; e2 += d2.x; e3 += d3.x;
+  // Clip the bounding box to the given rectangle.
+  glm::ivec2 imin = glm::ivec2(glm::max(glm::vec2(rect.min), bmin));
+  glm::ivec2 imax = glm::ivec2(glm::min(glm::vec2(rect.max), bmax));
+  if (imin.x >= imax.x || imin.y >= imax.y)
+    return;
+
+  // Depth is linear in screen space, so its minimum over the block is at one of the corner pixel
+  // centers. It can't be lower than the triangle minimum, even if the plane is steep.
+  const HiZBuffer* hiz = RenderState::ctx.occlusion_cull ? RenderState::ctx.hiz : nullptr;
+  const float min_z = std::min(std::min(prim.pos[0].z, prim.pos[1].z), prim.pos[2].z);
+  const auto occluded = [&prim, hiz, min_z](glm::ivec2 block) {
+    if (!hiz)
+      return false;
+    glm::vec2 p0 = glm::vec2(block) + 0.5f - prim.plane_origin;
+    glm::vec2 p1 = p0 + float(RASTER_BLOCK - 1);
+    float z = std::min(
+      std::min(prim.depth_plane.At(p0), prim.depth_plane.At({ p1.x, p0.y })),
+      std::min(prim.depth_plane.At({ p0.x, p1.y }), prim.depth_plane.At(p1))
+    );
+    return std::max(z, min_z) >= hiz->GetBlockDepth(block);
+  };
+
+  if (use_fixed_point(bmin, bmax)) {
+    FixedEdgeFunc edges[3];
+    if (setup_edges(v[0], v[1], v[2], edges))
+      rasterize_blocks(edges, get_fixed_coverage_kernel(RenderState::isa), occluded, imin, imax, func);
+    return;
   }
+
+  EdgeFunc edges[3];
+  setup_edges(v[0], v[1], v[2], edges);
+  rasterize_blocks(edges, get_coverage_kernel(RenderState::isa), occluded, imin, imax, func);
 }
 
 // Liang-Barsky line clipping algorithm.
@@ -339,52 +626,87 @@ bool line_clip(glm::vec2& a, glm::vec2& b, glm::vec2 min, glm::vec2 max) {
   return true;
 }
 
-void TrianglePrimitive::wireframe(const FragFunc& func) {
-  glm::vec2 a1 = glm::vec2(a), a2 = glm::vec2(b);
-  glm::vec2 b1 = glm::vec2(b), b2 = glm::vec2(c);
-  glm::vec2 c1 = glm::vec2(c), c2 = glm::vec2(a);
+/// Rasterize edges of the triangle.
+void wireframe_triangle(const RasterPrimitive& prim, const RasterPrimitive::FragFunc& func, const ScreenRect& rect) {
+  glm::vec2 a = glm::vec2(prim.pos[0]), b = glm::vec2(prim.pos[1]), c = glm::vec2(prim.pos[2]);
+  glm::vec2 a1 = a, a2 = b;
+  glm::vec2 b1 = b, b2 = c;
+  glm::vec2 c1 = c, c2 = a;
   glm::vec2 min{ 0, 0 };
-  glm::vec2 max = State::GetActiveFramebuffer()->GetSize() - glm::uvec2(1);
+  glm::vec2 max = RenderState::ctx.fb->GetSize() - glm::uvec2(1);
 
   if (line_clip(a1, a2, min, max))
-    bresenham_line(a1, a2, func);
+    bresenham_line(a1, a2, func, rect);
   if (line_clip(b1, b2, min, max))
-    bresenham_line(b1, b2, func);
+    bresenham_line(b1, b2, func, rect);
   if (line_clip(c1, c2, min, max))
-    bresenham_line(c1, c2, func);
+    bresenham_line(c1, c2, func, rect);
 }
 
-void TrianglePrimitive::Interpolate(glm::vec4& pos, Shader::InOutVars& vars) {
-  // Vectors from the fragment to all vertices of primitive.
-  glm::vec2 fa = glm::vec2(a) - glm::vec2(pos);
-  glm::vec2 fb = glm::vec2(b) - glm::vec2(pos);
-  glm::vec2 fc = glm::vec2(c) - glm::vec2(pos);
-
-  // Compute volume of triangle between two vectors.
-  const auto& get_volume = [](const glm::vec2& u, const glm::vec2& v) -> float { return std::abs((u.x * v.y - u.y * v.x)); };
+bool TrianglePrimitive::Setup() {
+  // Triangles behind the depth buffer contents in their whole bounding box are dropped before any
+  // coverage or attribute work.
+  if (RenderState::ctx.occlusion_cull) {
+    ScreenRect bounds = GetBounds();
+    if (RenderState::ctx.hiz->IsOccluded(bounds.min, bounds.max, std::min(std::min(a.z, b.z), c.z))) {
+      RenderStats::Add(RenderState::stats.primitives_occluded, 1);
+      return false;
+    }
+  }
 
-  // Compute the interpolation lambdas.
-  float la = get_volume(fb, fc) * m_invArea;
-  float lb = get_volume(fa, fc) * m_invArea;
-  float lc = get_volume(fb, fa) * m_invArea;
+  // Small triangles test their few candidate pixels right away. Triangles which don't cover any
+  // pixel center are dropped before the attribute setup.
+  m_raster.kind = RasterPrimitive::Kind::Triangle;
+  m_raster.pos = { glm::vec3(a), glm::vec3(b), glm::vec3(c) };
+  m_raster.small = false;
+  if (RenderState::ctx.small_triangles && !State::m_WriteFrame) {
+    ScreenRect bounds = GetBounds();
+    glm::ivec2 size = bounds.max - bounds.min;
+    if (size.x <= SMALL_TRIANGLE_SIZE && size.y <= SMALL_TRIANGLE_SIZE) {
+      glm::vec2 v[] = { glm::vec2(a), glm::vec2(b), glm::vec2(c) };
+      m_raster.small = true;
+      m_raster.small_min = bounds.min;
+      m_raster.small_mask = 0;
+      if (use_fixed_point(glm::vec2(bounds.min), glm::vec2(bounds.max))) {
+        FixedEdgeFunc edges[3];
+        if (setup_edges(v[0], v[1], v[2], edges))
+          m_raster.small_mask = small_coverage(edges, bounds.min, size);
+      } else {
+        EdgeFunc edges[3];
+        setup_edges(v[0], v[1], v[2], edges);
+        m_raster.small_mask = small_coverage(edges, bounds.min, size);
+      }
 
-  /// Perspectively Correct Lambdas
-  float s =  la / a.w + lb / b.w + lc / c.w;
-  glm::vec3 pcl = { la / (a.w * s), lb / (b.w * s), lc / (c.w * s) };
+      RenderStats::Add(RenderState::stats.small_triangles, 1);
+      if (m_raster.small_mask == 0)
+        return false;
+    }
+  }
 
-  // Interpolate attributes
-  auto ait = a_attr.begin();
-  auto bit = b_attr.begin();
-  auto cit = c_attr.begin();
-  for (; ait != a_attr.end(); ait++, bit++, cit++) {
-    if (ait->second.integer)
-      vars[ait->first].i4 = ait->second.i4;
+  m_raster.plane_origin = glm::vec2(a);
+  glm::vec2 e1 = glm::vec2(b) - glm::vec2(a);
+  glm::vec2 e2 = glm::vec2(c) - glm::vec2(a);
+
+  // Degenerate triangles get constant planes, they cover (almost) no pixels anyway.
+  float area = e1.x * e2.y - e1.y * e2.x;
+  float inv_area = area != 0.0f ? 1.0f / area : 0.0f;
+
+  m_raster.depth_plane = triangle_plane(a.z, b.z, c.z, e1, e2, inv_area);
+  glm::vec3 inv_w = 1.0f / glm::vec3(a.w, b.w, c.w);
+  m_raster.inv_w_plane = triangle_plane(inv_w.x, inv_w.y, inv_w.z, e1, e2, inv_area);
+
+  const VaryingLayout& layout = RenderState::ctx.prg->GetVaryingLayout();
+  m_raster.var_count = layout.Size();
+  m_raster.var_planes = m_varPlanes.data();
+  for (uint8_t i = 0; i < m_raster.var_count; i++) {
+    VarPlane& plane = m_varPlanes[i];
+    plane.integer = is_integer(layout[i].type);
+    if (plane.integer)
+      plane.flat = a_attr[i];
     else
-      vars[ait->first].f4 = simd_interp(ait->second.f4, bit->second.f4, cit->second.f4, pcl);
+      plane.plane = triangle_plane(a_attr[i].f4 * inv_w.x, b_attr[i].f4 * inv_w.y, c_attr[i].f4 * inv_w.z, e1, e2, inv_area);
   }
-
-  // Interpolate depth.
-  pos.z = pcl.x * a.z + pcl.y * b.z + pcl.z * c.z;
+  return true;
 }
 
 void TrianglePrimitive::SetPrimitive(Primitive prim) {
@@ -395,23 +717,25 @@ void TrianglePrimitive::SetPrimitive(Primitive prim) {
 
 LinePrimitive::LinePrimitive(const std::array<Vertex, 2>& vertices)
   : m_prim(Primitive::Lines)
-  , m_Vertices(vertices)
-{
-  m_ab = (glm::vec2)b - (glm::vec2)a;
-}
+  , m_Vertices(vertices) {}
+
+LinePrimitive::LinePrimitive(const LinePrimitive& other)
+  : RenderPrimitive(other)
+  , m_currentVertex(other.m_currentVertex)
+  , m_prim(other.m_prim)
+  , m_Vertices(other.m_Vertices) {}
 
 void LinePrimitive::SetPrimitive(Primitive prim) {
   assert((uint8_t)prim >= 0x20 && (uint8_t)prim <= 0x22);
   m_prim = prim;
 }
 
-void LinePrimitive::ProcessVertex(glm::vec4& position) {
+void LinePrimitive::ProcessVertex(const glm::vec4& position, const Shader::InOutVars& vars) {
   m_Vertices[m_currentVertex].pos = position;
-  m_Vertices[m_currentVertex].vars = RenderState::ctx.prg->GetVertexShader()->OutVars();
+  m_Vertices[m_currentVertex].vars = vars;
   m_currentVertex++;
   if (m_currentVertex == 2) {
     m_currentVertex = 0;
-    m_ab = (glm::vec2)b - (glm::vec2)a;
     m_OnEmit(this);
   }
 }
@@ -422,6 +746,12 @@ void LinePrimitive::Reset() {
 }
 
 void LinePrimitive::Clip(const PrimFunc& func) {
+  // Trivial reject, when both vertices are outside of the same frustum plane.
+  if (clip_outcode(a, 1.0f) & clip_outcode(b, 1.0f)) {
+    RenderStats::Add(RenderState::stats.primitives_rejected, 1);
+    return;
+  }
+
   unsigned sit = 0;
   sit |= uint8_t(a.z < -a.w) << 1;
   sit |= uint8_t(b.z < -b.w) << 0;
@@ -449,9 +779,10 @@ void LinePrimitive::Clip(const PrimFunc& func) {
   a.pos.z = -a.pos.w;
 
   // Interpolate attributes
-  for (auto& [name, var] : a.vars) {
-    if (!var.integer)
-      var.f4 = (1 - t) * var.f4 + t * b.vars[name].f4;
+  const VaryingLayout& layout = RenderState::ctx.prg->GetVaryingLayout();
+  for (uint8_t i = 0; i < layout.Size(); i++) {
+    if (!is_integer(layout[i].type))
+      a.vars[i].f4 = (1 - t) * a.vars[i].f4 + t * b.vars[i].f4;
   }
 
   func(this);
@@ -475,34 +806,54 @@ void LinePrimitive::NdcTransform() {
 }
 bool LinePrimitive::Cull() { return false; }
 
-void LinePrimitive::rasterize(const FragFunc& func) {
-  if (line_clip((glm::vec2&)a, (glm::vec2&)b, glm::vec2(0), glm::vec2(State::GetActiveFramebuffer()->GetSize() - glm::uvec2(1))))
-    bresenham_line(glm::ivec2(glm::round(a)), glm::ivec2(glm::round(b)), func);
+ScreenRect LinePrimitive::GetBounds() const {
+  // Bresenham works with rounded end points, so add one pixel on each side to be safe.
+  glm::vec2 bmin = glm::floor(glm::min(glm::vec2(a), glm::vec2(b))) - glm::vec2(1.0f);
+  glm::vec2 bmax = glm::ceil(glm::max(glm::vec2(a), glm::vec2(b))) + glm::vec2(1.0f);
+  return { glm::ivec2(bmin), glm::ivec2(bmax) };
 }
 
-void LinePrimitive::wireframe(const FragFunc& func) { rasterize(func); }
-
-void LinePrimitive::Interpolate(glm::vec4& pos, Shader::InOutVars& vars) {
-  auto ab = b - a;
-  float lb = (-ab.y * (pos.y - a.y) - ab.x * (pos.x - a.x))
-           / (-(ab.x * ab.x + ab.y * ab.y));
-  float la = 1.0f - lb;
+/// Rasterize the line. Wireframe lines are the same.
+void rasterize_line(const RasterPrimitive& prim, const RasterPrimitive::FragFunc& func, const ScreenRect& rect) {
+  glm::vec2 p1 = glm::vec2(prim.pos[0]), p2 = glm::vec2(prim.pos[1]);
+  if (line_clip(p1, p2, glm::vec2(0), glm::vec2(RenderState::ctx.fb->GetSize() - glm::uvec2(1))))
+    bresenham_line(glm::ivec2(glm::round(p1)), glm::ivec2(glm::round(p2)), func, rect);
+}
 
-  // Perspectively correct lambdas.
-  float k = (la / a.w + lb / b.w);
-  glm::vec2 pcl = { la / (a.w * k), lb / (b.w * k) };
+void RasterPrimitive::Rasterize(const FragFunc& func, const ScreenRect& rect) const {
+  if (kind == Kind::Line)
+    rasterize_line(*this, func, rect);
+  else if (State::m_WriteFrame)
+    wireframe_triangle(*this, func, rect);
+  else
+    rasterize_triangle(*this, func, rect);
+}
 
-  // Interpolate attributes.
-  auto ait = a_attr.begin();
-  auto bit = b_attr.begin();
-  for (; ait != a_attr.end(); ait++, bit++) {
-    if(ait->second.integer)
-      vars[ait->first].i4 = ait->second.i4;
+bool LinePrimitive::Setup() {
+  m_raster.kind = RasterPrimitive::Kind::Line;
+  m_raster.pos = { glm::vec3(a), glm::vec3(b), glm::vec3(0.0f) };
+  m_raster.small = false;
+  m_raster.plane_origin = glm::vec2(a);
+
+  // The line parameter is projection of the fragment onto the line.
+  glm::vec2 ab = glm::vec2(b) - glm::vec2(a);
+  float len2 = glm::dot(ab, ab);
+  glm::vec2 g = len2 != 0.0f ? ab / len2 : glm::vec2(0.0f);
+
+  m_raster.depth_plane = line_plane(a.z, b.z, g);
+  glm::vec2 inv_w = 1.0f / glm::vec2(a.w, b.w);
+  m_raster.inv_w_plane = line_plane(inv_w.x, inv_w.y, g);
+
+  const VaryingLayout& layout = RenderState::ctx.prg->GetVaryingLayout();
+  m_raster.var_count = layout.Size();
+  m_raster.var_planes = m_varPlanes.data();
+  for (uint8_t i = 0; i < m_raster.var_count; i++) {
+    VarPlane& plane = m_varPlanes[i];
+    plane.integer = is_integer(layout[i].type);
+    if (plane.integer)
+      plane.flat = a_attr[i];
     else
-      vars[ait->first].f4 = ait->second.f4 * pcl.x + bit->second.f4 * pcl.y;
+      plane.plane = line_plane(a_attr[i].f4 * inv_w.x, b_attr[i].f4 * inv_w.y, g);
   }
-
-  // Interpolate depth
-  pos.z = pcl.x * a.z + pcl.y * b.z;
+  return true;
 }
-
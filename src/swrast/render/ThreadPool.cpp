@@ -0,0 +1,70 @@
+/**
+ * @brief Implementation of render/ThreadPool.h
+ * @author Jakub Kloub, xkloub03, VUT FIT
+ * @file render/ThreadPool.cpp
+ */
+#include "render/ThreadPool.h"
+#include <algorithm>
+
+using namespace swrast;
+
+ThreadPool::ThreadPool(uint32_t worker_count) {
+  if (worker_count == 0)
+    worker_count = std::max(1u, std::thread::hardware_concurrency());
+
+  m_threads.reserve(worker_count);
+  for (uint32_t i = 0; i < worker_count; i++)
+    m_threads.emplace_back([this, i]{ workerLoop(i); });
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard lock(m_mutex);
+    m_stop = true;
+  }
+  m_wake.notify_all();
+  for (auto& t : m_threads)
+    t.join();
+}
+
+void ThreadPool::Run(const Task& task) {
+  std::unique_lock lock(m_mutex);
+  m_task = &task;
+  m_pending = m_threads.size();
+  m_error = nullptr;
+  m_generation++;
+  m_wake.notify_all();
+
+  m_done.wait(lock, [this]{ return m_pending == 0; });
+  m_task = nullptr;
+  if (m_error)
+    std::rethrow_exception(m_error);
+}
+
+void ThreadPool::workerLoop(uint32_t index) {
+  uint64_t generation = 0;
+  while (true) {
+    const Task* task = nullptr;
+    {
+      std::unique_lock lock(m_mutex);
+      m_wake.wait(lock, [&]{ return m_stop || m_generation != generation; });
+      if (m_stop)
+        return;
+      generation = m_generation;
+      task = m_task;
+    }
+
+    std::exception_ptr error = nullptr;
+    try {
+      (*task)(index);
+    } catch (...) {
+      error = std::current_exception();
+    }
+
+    std::lock_guard lock(m_mutex);
+    if (error && !m_error)
+      m_error = error;
+    if (--m_pending == 0)
+      m_done.notify_one();
+  }
+}
@@ -0,0 +1,81 @@
+/**
+ * @brief Implementation of render/TileBinner.h
+ * @author Jakub Kloub, xkloub03, VUT FIT
+ * @file render/TileBinner.cpp
+ */
+#include "render/TileBinner.h"
+#include <atomic>
+#include <cassert>
+
+using namespace swrast;
+
+TileBinner::TileBinner(uint32_t tile_size) : m_tileSize(tile_size) {
+  assert(tile_size > 0);
+}
+
+void TileBinner::Begin(glm::uvec2 fb_size) {
+  m_prims.clear();
+  m_varPlanes.clear();
+  m_varOffsets.clear();
+  if (fb_size != m_fbSize) {
+    m_fbSize = fb_size;
+    m_tileCount = (fb_size + glm::uvec2(m_tileSize - 1)) / m_tileSize;
+    m_bins.resize(m_tileCount.x * m_tileCount.y);
+  }
+  for (auto& bin : m_bins)
+    bin.clear();
+}
+
+void TileBinner::Bin(const RenderPrimitive& prim) {
+  ScreenRect bounds = prim.GetBounds();
+
+  // Clip the bounds to the framebuffer.
+  glm::ivec2 bmin = glm::max(bounds.min, glm::ivec2(0));
+  glm::ivec2 bmax = glm::min(bounds.max, glm::ivec2(m_fbSize));
+  if (bmin.x >= bmax.x || bmin.y >= bmax.y)
+    return;
+
+  // Range of tiles overlapped by the primitive (inclusive).
+  glm::uvec2 tmin = glm::uvec2(bmin) / m_tileSize;
+  glm::uvec2 tmax = glm::uvec2(bmax - glm::ivec2(1)) / m_tileSize;
+
+  uint32_t index = m_prims.size();
+  const RasterPrimitive& raster = prim.GetRaster();
+  m_prims.push_back(raster);
+  m_varOffsets.push_back(m_varPlanes.size());
+  m_varPlanes.insert(m_varPlanes.end(), raster.var_planes, raster.var_planes + raster.var_count);
+  for (uint32_t ty = tmin.y; ty <= tmax.y; ty++)
+    for (uint32_t tx = tmin.x; tx <= tmax.x; tx++)
+      m_bins[ty * m_tileCount.x + tx].push_back(index);
+}
+
+void TileBinner::Flush(ThreadPool& pool, const TileFunc& func) {
+  if (m_prims.empty())
+    return;
+  for (size_t i = 0; i < m_prims.size(); i++)
+    m_prims[i].var_planes = m_varPlanes.data() + m_varOffsets[i];
+
+  std::atomic<uint32_t> next_tile = 0;
+  pool.Run([&](uint32_t worker) {
+    uint32_t tile;
+    while ((tile = next_tile.fetch_add(1, std::memory_order_relaxed)) < m_bins.size()) {
+      const auto& bin = m_bins[tile];
+      if (bin.empty())
+        continue;
+
+      glm::uvec2 t = { tile % m_tileCount.x, tile / m_tileCount.x };
+      ScreenRect rect;
+      rect.min = glm::ivec2(t * m_tileSize);
+      rect.max = glm::ivec2(glm::min(t * m_tileSize + glm::uvec2(m_tileSize), m_fbSize));
+
+      for (uint32_t index : bin)
+        func(&m_prims[index], rect, worker);
+    }
+  });
+
+  m_prims.clear();
+  m_varPlanes.clear();
+  m_varOffsets.clear();
+  for (auto& bin : m_bins)
+    bin.clear();
+}
@@ -0,0 +1,99 @@
+/**
+ * @brief Implementation of render/VertexCache.h
+ * @author Jakub Kloub, xkloub03, VUT FIT
+ * @file render/VertexCache.cpp
+ */
+#include "render/VertexCache.h"
+
+using namespace swrast;
+
+void VertexCache::Begin(const VertexShader* shader, VertexContext* ctx, EmitFunc emit, bool record) {
+  m_shader = shader;
+  m_ctx = ctx;
+  m_emit = std::move(emit);
+  m_shaded = 0;
+  m_buckets.fill(0);
+  m_tags.fill(NO_INDEX);
+  m_head = 0;
+  m_queued = 0;
+  m_batch.m_Count = 0;
+  m_record = record;
+  m_steps.clear();
+  m_stepQueue.clear();
+}
+
+int VertexCache::lookup(uint32_t index) {
+  uint8_t entry = m_buckets[bucket(index)];
+  if (m_tags[entry] != index)
+    return -1;
+
+  // Entries which could be replaced by the misses before the flush can't be used.
+  if ((uint8_t)(entry - m_head) % SIZE < WIDE_LANES) {
+    m_tags[entry] = NO_INDEX;
+    return -1;
+  }
+  return entry;
+}
+
+void VertexCache::Push(uint32_t index) {
+  int entry = lookup(index);
+  if (entry < 0) {
+    entry = m_head;
+    m_head = (m_head + 1) % SIZE;
+    m_tags[entry] = index;
+    m_buckets[bucket(index)] = entry;
+    m_batchEntries[m_batch.m_Count] = entry;
+    m_batch.m_VertexId[m_batch.m_Count++] = index;
+  }
+  m_queue[m_queued++] = entry;
+
+  if (m_batch.m_Count == WIDE_LANES || m_queued == QUEUE_SIZE)
+    Flush();
+}
+
+void VertexCache::shade() {
+  if (m_batch.m_Count == 0)
+    return;
+
+  for (uint8_t lane = m_batch.m_Count; lane < WIDE_LANES; lane++)
+    m_batch.m_VertexId[lane] = m_batch.m_VertexId[m_batch.m_Count - 1];
+  m_shader->ExecuteBatch(*m_ctx, m_batch);
+  for (uint8_t lane = 0; lane < m_batch.m_Count; lane++) {
+    uint8_t entry = m_batchEntries[lane];
+    m_batch.GetLane(lane, m_positions[entry], m_vars[entry]);
+  }
+  m_shaded += m_batch.m_Count;
+  m_batch.m_Count = 0;
+}
+
+void VertexCache::emit(const uint8_t* entries, uint8_t count) {
+  for (uint8_t i = 0; i < count; i++)
+    m_emit(m_positions[entries[i]], m_vars[entries[i]]);
+}
+
+void VertexCache::Flush() {
+  if (m_record && m_queued > 0) {
+    m_steps.push_back({
+      .vertex_ids = m_batch.m_VertexId,
+      .entries = m_batchEntries,
+      .count = m_batch.m_Count,
+      .queued = m_queued,
+      .first_queued = (uint32_t)m_stepQueue.size(),
+    });
+    m_stepQueue.insert(m_stepQueue.end(), m_queue.begin(), m_queue.begin() + m_queued);
+  }
+  shade();
+  emit(m_queue.data(), m_queued);
+  m_queued = 0;
+}
+
+void VertexCache::Replay(size_t begin, size_t end) {
+  for (size_t i = begin; i < end; i++) {
+    const Step& step = m_steps[i];
+    m_batch.m_VertexId = step.vertex_ids;
+    m_batchEntries = step.entries;
+    m_batch.m_Count = step.count;
+    shade();
+    emit(m_stepQueue.data() + step.first_queued, step.queued);
+  }
+}
@@ -0,0 +1,52 @@
+/**
+ * @brief Implementation of render/VertexStage.h
+ * @author Jakub Kloub, xkloub03, VUT FIT
+ * @file render/VertexStage.cpp
+ */
+#include "render/VertexStage.h"
+#include "render/ThreadPool.h"
+#include <algorithm>
+#include <atomic>
+
+using namespace swrast;
+
+void VertexStage::Shade(ThreadPool& workers, const VertexShader* shader, std::vector<VertexContext>& contexts,
+                        uint32_t first, uint32_t count) {
+  m_first = first;
+  m_positions.resize(count);
+  // Varyings used without being declared get their slots on the first use. Vertices are shaded
+  // again in the rare case that happened during this draw, so the stored varyings are complete.
+  uint8_t used_varyings;
+  do {
+    m_varyings = shader->varyings ? shader->varyings->Size() : 0;
+    m_vars.resize((size_t)count * m_varyings);
+
+    const uint32_t chunks = (count + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    std::atomic<uint32_t> next_chunk = 0;
+    workers.Run([&](uint32_t worker) {
+      VertexContext& ctx = contexts[worker];
+      VertexBatch batch;
+      glm::vec4 position;
+      Shader::InOutVars vars;
+      uint32_t chunk;
+      while ((chunk = next_chunk.fetch_add(1, std::memory_order_relaxed)) < chunks) {
+        const uint32_t end = std::min(count, (chunk + 1) * CHUNK_SIZE);
+        for (uint32_t i = chunk * CHUNK_SIZE; i < end; i += WIDE_LANES) {
+          // Lanes past the end repeat the last vertex.
+          batch.m_Count = std::min<uint32_t>(WIDE_LANES, end - i);
+          for (uint8_t lane = 0; lane < WIDE_LANES; lane++)
+            batch.m_VertexId[lane] = first + i + std::min<uint8_t>(lane, batch.m_Count - 1);
+          shader->ExecuteBatch(ctx, batch);
+          for (uint8_t lane = 0; lane < batch.m_Count; lane++) {
+            batch.GetLane(lane, position, vars);
+            m_positions[i + lane] = position;
+            glm::vec4* v = m_vars.data() + (size_t)(i + lane) * m_varyings;
+            for (uint8_t j = 0; j < m_varyings; j++)
+              v[j] = vars[j].f4;
+          }
+        }
+      }
+    });
+    used_varyings = shader->varyings ? shader->varyings->Size() : 0;
+  } while (used_varyings != m_varyings);
+}
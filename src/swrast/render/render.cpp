@@ -5,98 +5,261 @@
  */
 #include "render/render.h"
 #include "error.hpp"
+#include "render/FetchKernel.h"
+#include "render/HiZBuffer.h"
 #include "render/RenderPrimitive.h"
+#include "render/RasterKernel.h"
+#include "render/ThreadPool.h"
+#include "render/TileBinner.h"
+#include "render/VertexCache.h"
+#include "render/VertexStage.h"
+#include "state/Framebuffer.h"
+#include "state/IndexBuffer.h"
 #include "state/State.h"
 #include "state/VertexArray.h"
 #include "state/VertexBuffer.h"
 #include "state/Program.h"
 #include "state/ObjectHandleFromId.hpp"
+#include <algorithm>
+#include <array>
+#include <bit>
 #include <cstring>
 #include <stdexcept>
 
 using namespace swrast;
 
-/// Call func for each vertex with given vertexID
-template<class Func>
-void for_each_vertex_id(const RenderContext& ctx, const Func& func) {
-  if (ctx.vao->HasIndexBuffer()) {
-    auto ibo = ctx.vao->GetIndexBuffer();
-    for (auto& index : ibo->data)
-      func(index);
+/// Maximum number of primitives held by the binner before the tiles are flushed mid-draw.
+constexpr size_t MAX_BINNED_PRIMITIVES = 1 << 16;
+
+/**
+ * @brief Call func for each vertex ID of the draw.
+ * @param restart Called instead of func for restart indices, when primitive restart is enabled.
+ */
+template<class Func, class Restart>
+void for_each_vertex_id(const RenderContext& ctx, const DrawRecord& draw, const Func& func, const Restart& restart) {
+  if (ctx.cmd.is_indexed) {
+    const IndexBuffer& ibo = *ctx.vao->GetIndexBuffer();
+    if ((size_t)draw.first + draw.count > ibo.Size())
+      RAISE(DrawRangeException, draw.first, draw.count, ibo.Size());
+    // Loop specialized for the index type.
+    ibo.Visit([&](auto indices) {
+      using Index = typename decltype(indices)::value_type;
+      auto index = indices.subspan(draw.first, draw.count);
+      if (ctx.primitive_restart) {
+        // Index is compared before the base vertex is added.
+        for (uint32_t i = 0; i < draw.count; i++) {
+          if (index[i] == restart_index<Index>())
+            restart();
+          else
+            func((uint32_t)(index[i] + draw.base_vertex));
+        }
+      } else {
+        for (uint32_t i = 0; i < draw.count; i++)
+          func((uint32_t)(index[i] + draw.base_vertex));
+      }
+    });
   } else {
-    for (uint32_t i = 0; i < ctx.cmd.count; i++)
-      func(i);
+    for (uint32_t i = 0; i < draw.count; i++)
+      func(draw.first + i);
   }
 }
 
-template<class T> T get(float* data) {
-    T d;
-    d = *reinterpret_cast<T*>(data);
-    return d;
-}
-std::any any_from_attributetype(AttributeType type, float* data) {
-  switch(type) {
-  case AttributeType::Int32: return int(data[0]);
-  case AttributeType::Float32: return data[0];
-  case AttributeType::Vec2: return get<glm::vec2>(data);
-  case AttributeType::IVec2: return get<glm::ivec2>(data);
-  case AttributeType::Vec3: return get<glm::vec3>(data);
-  case AttributeType::IVec3: return get<glm::ivec3>(data);
-  case AttributeType::Vec4: return get<glm::vec4>(data);
-  case AttributeType::IVec4: return get<glm::ivec4>(data);
-  case AttributeType::Mat3: return get<glm::mat3>(data);
-  case AttributeType::Mat4: return get<glm::mat4>(data);
+/// Select the fetch kernel of each stream for the instruction set of the renderer.
+void select_fetch_kernels(std::vector<AttributeStream>& streams) {
+  for (AttributeStream& stream : streams) {
+    // Gather takes 32-bit offsets. Valid samples lie within `size` bytes, so it bounds the offsets.
+    bool gather = reinterpret_cast<uintptr_t>(stream.data) % sizeof(float) == 0 && stream.stride % sizeof(float) == 0
+                  && stream.size <= INT32_MAX;
+    stream.fetch = get_fetch_kernel(get_byte_size(stream.type) / sizeof(float), gather, RenderState::isa);
   }
-  throw std::invalid_argument("any_from_attributetype: Invalid AttributeType");
 }
 
-void assemble_vertex_attributes(const RenderContext& ctx, ObjectHandle<VertexShader>& vs, uint32_t vertex_id) {
-  static float attr_data[16] = { 0.0f };  // 4x4 matrix has 16 floats
-  vs->m_VertexId = vertex_id;
-  int location = 0;
-  for (const auto& attr : ctx.vao->GetAttributes()) {
-    uint8_t* data = (uint8_t*)&attr.vbo->data[0];
-    std::memcpy(attr_data, data + attr.offset + attr.stride * vertex_id, get_byte_size(attr.type));
-    vs->m_Attributes[location] = any_from_attributetype(attr.type, attr_data);
-    location++;
+/// Check that the per instance attributes have a sample for every instance of the draw.
+void check_instance_streams(const std::vector<AttributeStream>& streams, uint32_t instance_count) {
+  for (const AttributeStream& stream : streams) {
+    if (!stream.IsPerInstance() || instance_count == 0)
+      continue;
+    size_t samples = stream.SampleCount();
+    size_t used = (instance_count - 1) / stream.divisor + 1;
+    if (used > samples)
+      RAISE(DrawRangeException, 0, used, samples);
   }
 }
 
-void pfo(FragmentShader* fs) {
-  auto fb = RenderState::ctx.fb;
-  auto tex_pos = glm::uvec2(fs->m_FragCoord);
+/// Screen position of the batch lane. Pixel centers are truncated to the pixel.
+inline glm::uvec2 lane_position(const WVec4& frag_coord, uint8_t lane) {
+  return glm::uvec2(frag_coord[0][lane], frag_coord[1][lane]);
+}
 
-  // Depth test
-  auto depth_buffer = fb->GetDepthBuffer();
-  if (RenderState::ctx.depth && depth_buffer.has_value()) {
-    float* depth = (float*)(depth_buffer->Get().GetPixel(tex_pos));
-    if (fs->m_FragCoord.z >= *depth)
-      return;
+/**
+ * @brief Test depths of the batch lanes against the depth buffer and write those which pass.
+ * @param frag_coord Positions of the batch lanes.
+ * @param mask Lanes to test.
+ * @return Lanes of the mask which passed the test.
+ */
+uint8_t depth_test(const WVec4& frag_coord, const WFloat& z, uint8_t mask) {
+  auto depth_buffer = RenderState::ctx.fb->GetDepthBuffer();
+  if (!RenderState::ctx.depth || !depth_buffer.has_value())
+    return mask;
+
+  Texture& tex = depth_buffer->Get();
+  for (uint8_t lanes = mask; lanes; lanes &= lanes - 1) {
+    uint8_t lane = std::countr_zero(lanes);
+    float* depth = (float*)(tex.GetPixel(lane_position(frag_coord, lane)));
+    if (z[lane] >= *depth) {
+      mask &= ~(1 << lane);
+      continue;
+    }
 
     // Depth write
-    *depth = fs->m_FragCoord.z;
+    *depth = z[lane];
   }
+  return mask;
+}
+
+/**
+ * @brief Per-fragment operations of the whole batch.
+ * @param mask Lanes to write.
+ * @param late_depth Whether to do the depth test. It is skipped when it was already done before shading.
+ */
+void pfo(const FragmentBatch& batch, uint8_t mask, bool late_depth) {
+  if (late_depth)
+    mask = depth_test(batch.m_FragCoord, batch.m_FragDepth, mask);
+  if (mask == 0)
+    return;
 
   // Write into color buffer
-  auto col_buf = fb->GetColorAttach(0);
+  auto col_buf = RenderState::ctx.fb->GetColorAttach(0);
   if (col_buf.has_value()) {
-    uint8_t* pixel = col_buf->Get().GetPixel(tex_pos);
-    glm::vec<4, uint8_t> col = fs->m_FragColor * glm::vec4(255);
-    std::memcpy(pixel, &col, channel_count(col_buf->Get().m_IntFormat));
+    Texture& tex = col_buf->Get();
+    size_t channels = channel_count(tex.m_IntFormat);
+    WVec4 colors = batch.m_FragColor * WFloat(255.0f);
+    for (uint8_t lanes = mask; lanes; lanes &= lanes - 1) {
+      uint8_t lane = std::countr_zero(lanes);
+      glm::vec<4, uint8_t> col = colors.Lane(lane);
+      std::memcpy(tex.GetPixel(lane_position(batch.m_FragCoord, lane)), &col, channels);
+    }
   }
 
   // TODO: Write blended pixel into framebuffer.
 }
 
-void process_pixel(RenderPrimitive* prim, glm::vec4& pix_pos) {
-  auto& fs = RenderState::ctx.prg->GetFragmentShader();
+/// Fragment counters accumulated over a whole block, so the shared stats are updated just once.
+struct FragmentCounters {
+  uint64_t shaded = 0;
+  uint64_t helpers = 0;
+  uint64_t early_killed = 0;
+  uint64_t discarded = 0;
+};
+
+/// Get mask of the batch lanes in quads with at least one lane of `mask`.
+inline uint8_t covered_quads(uint8_t mask) {
+  // Fold the quad lanes (0, 1, 4, 5 and 2, 3, 6, 7) onto the first lane of the quad.
+  uint8_t any = (mask | mask >> 1 | mask >> FragmentBatch::WIDTH | mask >> (FragmentBatch::WIDTH + 1)) & 0b0101;
+  return (any * 0b11) * 0b10001;
+}
+
+/// Set the x and y of the batch lane fragment coordinates to the center of given pixel.
+inline void set_lane_position(FragmentBatch& batch, uint8_t lane, glm::ivec2 p) {
+  batch.m_FragCoord[0][lane] = (float)p.x + 0.5f;
+  batch.m_FragCoord[1][lane] = (float)p.y + 0.5f;
+}
+
+/**
+ * @brief Shade a batch with x and y of the fragment coordinates already set.
+ *
+ * The batch is either a pair of 2x2 quads (4x2 pixels) or up to 8 separate pixels of a line.
+ * @param mask Covered lanes of the batch. The uncovered ones are shaded only as helpers.
+ */
+void process_batch(const RasterPrimitive* prim, const FragmentShader* fs, FragmentContext& fctx, FragmentBatch& batch,
+                   uint8_t mask, FragmentCounters& counters) {
+  batch.m_FragCoord[3] = WFloat(1.0f);
+
+  // Early depth test. Hidden pixels become helpers, so the quads still have valid derivatives.
+  bool early_depth = RenderState::ctx.depth && fs->AllowsEarlyDepth();
+  if (early_depth) {
+    uint8_t visible = depth_test(batch.m_FragCoord, prim->InterpolateDepth(batch.m_FragCoord), mask);
+    counters.early_killed += std::popcount(uint8_t(mask & ~visible));
+    mask = visible;
+    if (mask == 0)
+      return;
+  }
+
+  // Interpolate VS output variables and pixel's depth for all pixels, including the helpers.
+  prim->Interpolate(batch);
+  batch.m_FragDepth = batch.m_FragCoord[2];
+  batch.m_Mask = mask;
+  fs->ExecuteBatch(fctx, batch);
+
+  int covered = std::popcount(mask);
+  counters.shaded += covered;
+  if (batch.m_Quads)
+    counters.helpers += std::popcount(covered_quads(mask)) - covered;
+
+  // Discarded fragments are removed from the batch mask.
+  uint8_t kept = mask & batch.m_Mask;
+  counters.discarded += covered - std::popcount(kept);
+  pfo(batch, kept, !early_depth);
+}
+
+/// Shade all batches of the fragment block with at least one covered pixel.
+void process_block(const RasterPrimitive* prim, const FragmentShader* fs, FragmentContext& fctx, const FragmentBlock& block) {
+  const uint64_t mask = block.mask;
+  FragmentBatch batch;
+  FragmentCounters counters;
+  batch.m_Quads = block.quads;
+  if (!block.quads) {
+    // Pixels are packed into the lanes in order. Unused lanes repeat the last pixel.
+    for (uint64_t pixels = mask; pixels;) {
+      uint8_t count = 0;
+      glm::ivec2 p;
+      for (; pixels && count < WIDE_LANES; pixels &= pixels - 1) {
+        int bit = std::countr_zero(pixels);
+        p = block.origin + glm::ivec2(bit % RASTER_BLOCK, bit / RASTER_BLOCK);
+        set_lane_position(batch, count++, p);
+      }
+      for (uint8_t lane = count; lane < WIDE_LANES; lane++)
+        set_lane_position(batch, lane, p);
+      process_batch(prim, fs, fctx, batch, uint8_t((1u << count) - 1), counters);
+    }
+  } else {
+    for (int y = 0; y < RASTER_BLOCK; y += 2) {
+      for (int x = 0; x < RASTER_BLOCK; x += FragmentBatch::WIDTH) {
+        int bit = y * RASTER_BLOCK + x;
+        uint8_t batch_mask = ((mask >> bit) & 0xf) | (((mask >> (bit + RASTER_BLOCK)) & 0xf) << FragmentBatch::WIDTH);
+        if (batch_mask == 0)
+          continue;
+        for (uint8_t lane = 0; lane < WIDE_LANES; lane++)
+          set_lane_position(batch, lane, block.origin + glm::ivec2(x + lane % FragmentBatch::WIDTH, y + lane / FragmentBatch::WIDTH));
+        process_batch(prim, fs, fctx, batch, batch_mask, counters);
+      }
+    }
+  }
 
-  // Interpolate VS output variables and pixel's depth.
-  prim->Interpolate(pix_pos, fs->InVars());
-  fs->m_FragCoord = pix_pos;
-  fs->Execute();
+  // Only shaded fragments could have written depth. The block never crosses tiles, so its depth
+  // isn't written by other workers during the update.
+  if (RenderState::ctx.hiz && counters.shaded > 0) {
+    Texture& depth = RenderState::ctx.fb->GetDepthBuffer()->Get();
+    RenderState::ctx.hiz->UpdateBlock(block.origin, (const float*)depth.GetPixel({ 0, 0 }), depth.GetSize());
+  }
 
-  pfo(fs.obj_ptr);
+  RenderStats::Add(RenderState::stats.fragments_shaded, counters.shaded);
+  RenderStats::Add(RenderState::stats.helper_invocations, counters.helpers);
+  RenderStats::Add(RenderState::stats.fragments_early_killed, counters.early_killed);
+  RenderStats::Add(RenderState::stats.fragments_discarded, counters.discarded);
+}
+
+/// Rasterize and shade all primitives stored in the tile binner.
+void flush_tiles() {
+  if (RenderState::binner->Size() == 0)
+    return;
+
+  // The shader is shared, every worker has its own invocation context.
+  const FragmentShader* fs = RenderState::ctx.prg->GetFragmentShader().obj_ptr;
+  RenderState::binner->Flush(*RenderState::workers, [fs](const RasterPrimitive* prim, const ScreenRect& tile, uint32_t worker) {
+    FragmentContext* fctx = &RenderState::fs_contexts[worker];
+    prim->Rasterize([prim, fs, fctx](const FragmentBlock& block){ process_block(prim, fs, *fctx, block); }, tile);
+  });
 }
 
 void process_primitive(RenderPrimitive* prim) {
@@ -105,7 +268,21 @@ void process_primitive(RenderPrimitive* prim) {
     prim->NdcTransform();
     if (prim->Cull())
       return;
-    prim->Rasterize([prim](glm::vec4 pix_pos){ process_pixel(prim, pix_pos); });
+    if (!prim->Setup())
+      return;
+
+    if (RenderState::binner) {
+      RenderState::binner->Bin(*prim);
+      if (RenderState::binner->Size() >= MAX_BINNED_PRIMITIVES)
+        flush_tiles();
+      return;
+    }
+
+    const FragmentShader* fs = RenderState::ctx.prg->GetFragmentShader().obj_ptr;
+    FragmentContext* fctx = &RenderState::fs_contexts[0];
+    ScreenRect fb_rect = { glm::ivec2(0), glm::ivec2(RenderState::ctx.fb->GetSize()) };
+    const RasterPrimitive* raster = &prim->GetRaster();
+    raster->Rasterize([raster, fs, fctx](const FragmentBlock& block){ process_block(raster, fs, *fctx, block); }, fb_rect);
   });
 }
 
@@ -133,7 +310,228 @@ RenderPrimitive* new_primitive(const RenderContext& ctx) {
   throw std::invalid_argument("new_primitive: Invalid draw primitive");
 }
 
+/// Range of vertex IDs used by a draw command.
+struct VertexRange {
+  uint64_t first = 0;
+  uint64_t count = 0;
+  /// Number of the indices (or vertices of non-indexed draws) submitted by the draws.
+  uint64_t submitted = 0;
+};
+
+/// Get number of the indices (or vertices of non-indexed draws) submitted by the draws of the command.
+uint64_t submitted_vertices(const RenderContext& ctx) {
+  uint64_t total = 0;
+  for (const DrawRecord& draw : ctx.cmd.draws)
+    total += draw.count;
+  return total;
+}
+
+/**
+ * @brief Get upper bound (exclusive) of the vertex IDs of an indexed command without reading the indices.
+ *
+ * Uses the maximum index of the whole index buffer, so it may be higher than the actual bound for
+ * draws using only a part of the buffer with a base vertex. Negative base vertex can wrap the
+ * smaller indices around, so there is no bound then (UINT64_MAX).
+ */
+uint64_t vertex_id_bound(const RenderContext& ctx) {
+  const uint32_t max_index = ctx.vao->GetIndexBuffer()->MaxIndex(ctx.primitive_restart);
+  uint64_t bound = 0;
+  for (const DrawRecord& draw : ctx.cmd.draws) {
+    if (draw.count == 0)
+      continue;
+    if (draw.base_vertex < 0)
+      return UINT64_MAX;
+    bound = std::max<uint64_t>(bound, (uint64_t)max_index + draw.base_vertex + 1);
+  }
+  return bound;
+}
+
+/**
+ * @brief Get range of the vertices referenced by the draws of the command.
+ * @note Indexed draws read all their indices, see vertex_id_bound() for the cheap check.
+ */
+VertexRange referenced_vertices(const RenderContext& ctx) {
+  uint64_t min = UINT64_MAX, max = 0;
+  uint64_t total = 0;
+  for (const DrawRecord& draw : ctx.cmd.draws) {
+    if (ctx.cmd.is_indexed) {
+      for_each_vertex_id(ctx, draw, [&](uint32_t vertex_id){
+        min = std::min<uint64_t>(min, vertex_id);
+        max = std::max<uint64_t>(max, vertex_id);
+      }, [](){});
+    } else if (draw.count > 0) {
+      min = std::min<uint64_t>(min, draw.first);
+      max = std::max<uint64_t>(max, (uint64_t)draw.first + draw.count - 1);
+    }
+    total += draw.count;
+  }
+  if (min > max)
+    return { .submitted = total };
+  return { min, max - min + 1, total };
+}
+
+/// Get number of the vertices which have a sample in all the per vertex attributes.
+size_t vertex_samples(const std::vector<AttributeStream>& streams) {
+  size_t samples = SIZE_MAX;
+  for (const AttributeStream& stream : streams) {
+    if (!stream.IsPerInstance())
+      samples = std::min(samples, stream.SampleCount());
+  }
+  return samples;
+}
+
+/// Check that the per vertex attributes have a sample for every vertex of the range.
+void check_vertex_streams(const std::vector<AttributeStream>& streams, const VertexRange& range) {
+  size_t samples = vertex_samples(streams);
+  if (range.count > 0 && range.first + range.count > samples)
+    RAISE(DrawRangeException, range.first, range.count, samples);
+}
+
+/// Check if the range is worth shading in parallel by the vertex stage.
+bool worth_staging(const VertexRange& range) {
+  // Vertices of the range not referenced by any draw would be shaded for nothing.
+  return range.count >= VertexStage::MIN_VERTICES && range.count <= range.submitted;
+}
+
+/// Shade the referenced vertices in parallel by the vertex stage, then assemble the primitives.
+void draw_staged(RenderPrimitive* p, const VertexShader* vs, const VertexRange& range) {
+  const RenderContext& ctx = RenderState::ctx;
+  glm::vec4 position;
+  Shader::InOutVars vars;
+  for (uint32_t instance = 0; instance < ctx.cmd.instance_count; instance++) {
+    for (auto& vctx : RenderState::vs_contexts)
+      vctx.m_InstanceId = instance;
+    RenderState::vertex_stage->Shade(*RenderState::workers, vs, RenderState::vs_contexts, (uint32_t)range.first,
+                                     (uint32_t)range.count);
+    RenderState::stats.vertices_shaded += range.count;
+
+    for (const DrawRecord& draw : ctx.cmd.draws) {
+      p->Reset();
+      for_each_vertex_id(ctx, draw, [&](uint32_t vertex_id){
+        RenderState::vertex_stage->Fetch(vertex_id, position, vars);
+        p->ProcessVertex(position, vars);
+      }, [p](){ p->Reset(); });
+      RenderState::stats.indices_processed += draw.count;
+    }
+  }
+}
+
+/// Shade the vertices of an indexed draw through the vertex cache and assemble them right away.
+void draw_cached(RenderPrimitive* p, const VertexShader* vs) {
+  const RenderContext& ctx = RenderState::ctx;
+  VertexContext& vctx = RenderState::vs_contexts[0];
+  VertexCache& cache = *RenderState::vertex_cache;
+  RenderStats& stats = RenderState::stats;
+
+  // Indices repeat, so the shaded vertices are reused through the cache. Vertex IDs already
+  // include the base vertex, so the cache is shared by all the draws.
+  const bool instanced = ctx.cmd.instance_count > 1;
+  vctx.m_InstanceId = 0;
+  cache.Begin(vs, &vctx, [p](const glm::vec4& position, const Shader::InOutVars& vars) {
+    p->ProcessVertex(position, vars);
+  }, instanced);
+  // Recorded steps at the end of each draw and each restarted primitive, where the primitive is reset.
+  std::vector<size_t> draw_steps;
+  draw_steps.reserve(ctx.cmd.draws.size());
+  const auto end_primitive = [&]() {
+    // Queued vertices belong to the primitive before the restart.
+    cache.Flush();
+    draw_steps.push_back(cache.GetStepCount());
+  };
+  for (const DrawRecord& draw : ctx.cmd.draws) {
+    p->Reset();
+    for_each_vertex_id(ctx, draw, [&](uint32_t vertex_id){ cache.Push(vertex_id); }, [&](){
+      end_primitive();
+      p->Reset();
+    });
+    end_primitive();
+    stats.indices_processed += draw.count;
+  }
+  // Index fetching and the cache lookups don't depend on the instance, so the other instances
+  // just repeat the shading and assembly steps of the first one.
+  for (uint32_t instance = 1; instance < ctx.cmd.instance_count; instance++) {
+    vctx.m_InstanceId = instance;
+    size_t begin = 0;
+    for (size_t end : draw_steps) {
+      p->Reset();
+      cache.Replay(begin, end);
+      begin = end;
+    }
+  }
+  if (instanced)
+    stats.indices_processed *= ctx.cmd.instance_count;
+  stats.vertices_shaded = cache.GetShadedCount();
+}
+
+/// Shade the vertices of a non-indexed draw in batches and assemble them right away.
+void draw_direct(RenderPrimitive* p, const VertexShader* vs) {
+  const RenderContext& ctx = RenderState::ctx;
+  VertexContext& vctx = RenderState::vs_contexts[0];
+  RenderStats& stats = RenderState::stats;
+
+  VertexBatch batch;
+  glm::vec4 position;
+  Shader::InOutVars vars;
+  const auto process_batch = [&]() {
+    for (uint8_t lane = batch.m_Count; lane < WIDE_LANES; lane++)
+      batch.m_VertexId[lane] = batch.m_VertexId[batch.m_Count - 1];
+    vs->ExecuteBatch(vctx, batch);
+    for (uint8_t lane = 0; lane < batch.m_Count; lane++) {
+      batch.GetLane(lane, position, vars);
+      p->ProcessVertex(position, vars);
+    }
+    stats.vertices_shaded += batch.m_Count;
+    batch.m_Count = 0;
+  };
+  for (uint32_t instance = 0; instance < ctx.cmd.instance_count; instance++) {
+    // Batches never mix instances.
+    vctx.m_InstanceId = instance;
+    for (const DrawRecord& draw : ctx.cmd.draws) {
+      p->Reset();
+      for_each_vertex_id(ctx, draw, [&](uint32_t vertex_id){
+        batch.m_VertexId[batch.m_Count++] = vertex_id;
+        if (batch.m_Count == WIDE_LANES)
+          process_batch();
+      }, [](){});
+      if (batch.m_Count > 0)
+        process_batch();
+      stats.indices_processed += draw.count;
+    }
+  }
+}
+
+void RenderState::Init(const StateSpec& spec) {
+  Destroy();
+  isa = std::min(spec.simd_isa.value_or(SimdIsa::AVX2), detect_simd_isa());
+  if (spec.backend == RenderBackend::Tiled) {
+    workers = std::make_shared<ThreadPool>(spec.worker_count);
+    // Tiles are made of whole raster blocks, so each block (and its Hi-Z cell) belongs to one worker.
+    const uint32_t block = RASTER_BLOCK;
+    uint32_t tile_size = (std::max(spec.tile_size, 1u) + block - 1) / block * block;
+    binner = std::make_shared<TileBinner>(tile_size);
+  }
+  fs_contexts.resize(workers ? workers->Size() : 1);
+  vs_contexts.resize(workers ? workers->Size() : 1);
+  vertex_cache = std::make_shared<VertexCache>();
+  if (workers)
+    vertex_stage = std::make_shared<VertexStage>();
+}
+
+void RenderState::Destroy() {
+  binner.reset();
+  workers.reset();
+  fs_contexts.clear();
+  vs_contexts.clear();
+  vertex_cache.reset();
+  vertex_stage.reset();
+}
+
 void RenderState::Draw(const RenderCommand& render_command) {
+  // No instance means no vertex is shaded, whatever path the draw would take.
+  if (render_command.instance_count == 0) {
+    stats = {};
+    return;
+  }
   ctx = {
     .cmd = render_command,
     .prg = ObjectHandle<Program>::FromId(State::m_activeProgram.value()),
@@ -141,18 +539,56 @@ void RenderState::Draw(const RenderCommand& render_command) {
     .fb = ObjectHandle<Framebuffer>::FromId(State::m_activeFb),
     .cull = State::m_CullFace,
     .depth = State::m_DepthTest,
+    .raster = State::m_RasterMode,
+    .guard_band = State::m_GuardBand,
+    .small_triangles = State::m_SmallTriangles,
+    .hiz = nullptr,
+    .occlusion_cull = false,
+    .primitive_restart = State::m_PrimitiveRestart,
   };
-  if (ctx.prg->GetVertexShader()->m_Attributes.size() < ctx.vao->GetAttributes().size())
-    ctx.prg->GetVertexShader()->m_Attributes.resize(ctx.vao->GetAttributes().size());
-  ctx.prg->GetFragmentShader()->InVars().clear();
+  // Hi-Z buffer is maintained whenever depth is written. Rejection needs the interpolated depth to
+  // be the final one, so it's off for shaders writing their own depth and for wireframe.
+  if (ctx.depth && ctx.fb->GetDepthBuffer().has_value() && ctx.fb->GetHiZ().IsBuilt()) {
+    ctx.hiz = &ctx.fb->GetHiZ();
+    ctx.occlusion_cull = State::m_OcclusionCulling && !ctx.prg->GetFragmentShader()->GetSpec().writes_depth && !State::m_WriteFrame;
+  }
+  stats = {};
+  if (ctx.cmd.is_indexed && !ctx.vao->HasIndexBuffer())
+    RAISE(ObjectNotFoundException, ctx.vao->Id);
+  // Attributes are read by the shader straight from the vertex buffers, so all the referenced
+  // samples have to be there.
+  std::vector<AttributeStream> streams = ctx.vao->GetStreams();
+  select_fetch_kernels(streams);
+  // The exact range of indexed draws costs a pass over the indices. It's needed only by the vertex
+  // stage, or when the cheap bound from the maximum index fails and the draw may still be valid.
+  const uint64_t submitted = submitted_vertices(ctx);
+  const bool may_stage = vertex_stage && submitted >= VertexStage::MIN_VERTICES;
+  VertexRange range = { .submitted = submitted };
+  if (!ctx.cmd.is_indexed || may_stage || vertex_id_bound(ctx) > vertex_samples(streams))
+    range = referenced_vertices(ctx);
+  check_vertex_streams(streams, range);
+  check_instance_streams(streams, ctx.cmd.instance_count);
+  const VertexShader* vs = ctx.prg->GetVertexShader().obj_ptr;
+  for (auto& vctx : vs_contexts)
+    vctx.Bind(vs, &streams);
+  for (auto& fctx : fs_contexts)
+    fctx.Bind(ctx.prg->GetFragmentShader().obj_ptr);
 
   RenderPrimitive* p = new_primitive(ctx);
   p->m_OnEmit = process_primitive;
 
-  for_each_vertex_id(ctx, [&](uint32_t vertex_id){
-    auto& vs = ctx.prg->GetVertexShader();
-    assemble_vertex_attributes(ctx, vs, vertex_id);
-    vs->Execute();
-    p->ProcessVertex(vs->m_Position);
-  });
+  if (binner)
+    binner->Begin(ctx.fb->GetSize());
+
+  // Large draws are shaded by all the workers before the assembly. Otherwise vertices are shaded
+  // in batches and assembled right away.
+  if (vertex_stage && worth_staging(range))
+    draw_staged(p, vs, range);
+  else if (ctx.cmd.is_indexed)
+    draw_cached(p, vs);
+  else
+    draw_direct(p, vs);
+
+  if (binner)
+    flush_tiles();
 }
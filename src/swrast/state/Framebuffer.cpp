@@ -37,6 +37,8 @@ Framebuffer::Framebuffer(glm::uvec2 size, FramebufferSpec spec)
   if (spec.color_atts.size() == 0) {
     m_state = FramebufferState::MissingColor;
   }
+  if (spec.depth_buffer.has_value())
+    m_hiZ = HiZBuffer(size);
 }
 
 Framebuffer Framebuffer::CreateBasic(glm::uvec2 size) {
@@ -77,7 +79,13 @@ Framebuffer& Framebuffer::Clear(Opt<Color> color, bool depth) {
       ca->Fill(color.value());
   }
   if (depth && m_depthBuffer.has_value()) {
-    m_depthBuffer.value()->Fill(glm::vec4(1.0f));
+    // Depth is stored as float in the 4 bytes of each pixel, so it can't go through Texture::Fill().
+    // The depth buffer may differ in size from the framebuffer (SizeMismatch), so use its own size.
+    Texture& depth_tex = m_depthBuffer.value().Get();
+    float* data = (float*)depth_tex.GetPixel({ 0, 0 });
+    std::fill_n(data, (size_t)depth_tex.GetSize().x * depth_tex.GetSize().y, 1.0f);
+    if (m_hiZ.IsBuilt())
+      m_hiZ.Clear(1.0f);
   }
   return *this;
 }
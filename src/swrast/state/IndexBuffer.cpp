@@ -5,9 +5,68 @@
  */
 #include "state/IndexBuffer.h"
 #include "state/State.h"
+#include <algorithm>
 
 using namespace swrast;
 
+IndexType swrast::smallest_index_type(uint32_t max_index) {
+  if (max_index <= UINT8_MAX)
+    return IndexType::UInt8;
+  if (max_index <= UINT16_MAX)
+    return IndexType::UInt16;
+  return IndexType::UInt32;
+}
+
+uint32_t swrast::restart_index(IndexType type) {
+  switch (type) {
+    case IndexType::UInt8: return restart_index<uint8_t>();
+    case IndexType::UInt16: return restart_index<uint16_t>();
+    default: return restart_index<uint32_t>();
+  }
+}
+
+void IndexBuffer::updateMaxIndex() {
+  m_maxIndex = 0;
+  m_maxIndexRestart = 0;
+  Visit([&](auto indices) {
+    using Index = typename decltype(indices)::value_type;
+    for (Index index : indices) {
+      m_maxIndex = std::max<uint32_t>(m_maxIndex, index);
+      if (index != restart_index<Index>())
+        m_maxIndexRestart = std::max<uint32_t>(m_maxIndexRestart, index);
+    }
+  });
+}
+
+/// Copy the indices into vector of another type.
+template<class T, class From>
+static std::vector<T> convert_indices(std::span<const From> indices, bool primitive_restart) {
+  if (!primitive_restart)
+    return std::vector<T>(indices.begin(), indices.end());
+  std::vector<T> result;
+  result.reserve(indices.size());
+  for (From index : indices)
+    result.push_back(index == restart_index<From>() ? restart_index<T>() : T(index));
+  return result;
+}
+
+IndexType IndexBuffer::Compact(bool primitive_restart) {
+  // The restart index of the new type must not collide with a vertex index.
+  const uint32_t max = MaxIndex(primitive_restart);
+  IndexType type = smallest_index_type(primitive_restart ? max + 1 : max);
+  if (type >= GetType())
+    return GetType();
+  Visit([&](auto indices) {
+    using From = typename decltype(indices)::value_type;
+    if (type == IndexType::UInt8)
+      m_data = convert_indices<uint8_t, From>(indices, primitive_restart);
+    else
+      m_data = convert_indices<uint16_t, From>(indices, primitive_restart);
+  });
+  updateMaxIndex();
+  return type;
+}
+
 template<>
 OptRef<IndexBuffer> State::GetObject(ObjectId id) {
   if (m_ibos.count(id) == 0)
@@ -0,0 +1,24 @@
+/**
+ * @brief Implementation of state/IndirectBuffer.h
+ * @file state/IndirectBuffer.cpp
+ * @author Jakub Kloub, xkloub03, VUT FIT
+ */
+#include "state/IndirectBuffer.h"
+#include "state/State.h"
+
+using namespace swrast;
+
+template<>
+OptRef<IndirectBuffer> State::GetObject(ObjectId id) {
+  if (m_indirectBufs.count(id) == 0)
+    return {};
+  return m_indirectBufs[id];
+}
+
+template<>
+ObjectHandle<IndirectBuffer> State::CreateObject(IndirectBuffer&& buf) {
+  return {
+    .obj_ptr = &(State::m_indirectBufs.emplace(buf.Id, std::move(buf)).first->second),
+    .obj_id = buf.Id,
+  };
+}
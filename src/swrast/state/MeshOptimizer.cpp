@@ -0,0 +1,456 @@
+/**
+ * @brief Implementation of state/MeshOptimizer.h
+ * @file state/MeshOptimizer.cpp
+ * @author Jakub Kloub, xkloub03, VUT FIT
+ */
+#include "state/MeshOptimizer.h"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <limits>
+#include <numeric>
+
+using namespace swrast;
+
+constexpr uint32_t CACHE_SIZE = MeshOptimizer::CACHE_SIZE;
+
+/**
+ * @brief FIFO vertex cache simulation.
+ *
+ * A vertex is cached if it was inserted less than CACHE_SIZE insertions ago, so neither lookups
+ * nor resets have to walk the cache.
+ */
+class CacheSim {
+public:
+  explicit CacheSim(uint32_t vertex_count) : m_inserted(vertex_count, 0) {}
+
+  /// Access the vertex. Returns true on a cache hit.
+  inline bool Access(uint32_t vertex) {
+    if (m_inserted[vertex] != 0 && m_time - m_inserted[vertex] < CACHE_SIZE)
+      return true;
+    m_inserted[vertex] = ++m_time;
+    return false;
+  }
+  /// Get number of misses of the triangle.
+  inline uint32_t AccessTriangle(const uint32_t* tri) {
+    return uint32_t(!Access(tri[0])) + !Access(tri[1]) + !Access(tri[2]);
+  }
+  /// Evict all the vertices.
+  inline void Reset() { m_time += CACHE_SIZE; }
+
+private:
+  /// Time of insertion of each vertex (0 for never inserted).
+  std::vector<uint64_t> m_inserted;
+  uint64_t m_time = 0;
+};
+
+MeshOptimizer::MeshOptimizer(IndexBuffer::Data&& indices, VertexBuffer::Data&& vertices, uint32_t vertex_stride,
+                             uint32_t position_offset)
+  : indices(std::move(indices)), vertices(std::move(vertices))
+  , m_stride(vertex_stride), m_positionOffset(position_offset) {}
+
+MeshStats MeshOptimizer::Analyze() const {
+  MeshStats stats;
+  const size_t triangles = indices.size() / 3;
+  if (triangles == 0)
+    return stats;
+
+  // Vertex buffer reads are simulated with a 16 KiB direct mapped cache of 64 byte lines.
+  constexpr size_t LINE_SIZE = 64;
+  constexpr size_t LINES = 256;
+  std::array<size_t, LINES> lines;
+  lines.fill(SIZE_MAX);
+  const size_t vertex_size = m_stride * sizeof(float);
+
+  CacheSim cache(vertexCount());
+  std::vector<bool> referenced(vertexCount(), false);
+  size_t misses = 0, unique = 0, fetched = 0;
+  for (uint32_t vertex : indices) {
+    if (!referenced[vertex]) {
+      referenced[vertex] = true;
+      unique++;
+    }
+    if (cache.Access(vertex))
+      continue;
+
+    misses++;
+    size_t begin = vertex * vertex_size;
+    for (size_t line = begin / LINE_SIZE; line <= (begin + vertex_size - 1) / LINE_SIZE; line++) {
+      if (lines[line % LINES] != line) {
+        lines[line % LINES] = line;
+        fetched += LINE_SIZE;
+      }
+    }
+  }
+
+  stats.acmr = (float)misses / triangles;
+  stats.atvr = (float)misses / unique;
+  stats.overfetch = (float)fetched / (unique * vertex_size);
+  stats.overdraw = measureOverdraw();
+  return stats;
+}
+
+float MeshOptimizer::measureOverdraw() const {
+  constexpr int GRID = 256;
+  glm::vec3 min(std::numeric_limits<float>::max()), max(std::numeric_limits<float>::lowest());
+  for (uint32_t vertex : indices) {
+    min = glm::min(min, position(vertex));
+    max = glm::max(max, position(vertex));
+  }
+  float extent = std::max({ max.x - min.x, max.y - min.y, max.z - min.z });
+  if (!(extent > 0.0f))
+    return 1.0f;
+  const float scale = (GRID - 1) / extent;
+
+  std::vector<float> depth(GRID * GRID);
+  uint64_t shaded = 0, covered = 0;
+  for (int axis = 0; axis < 3; axis++) {
+    const int u = (axis + 1) % 3, v = (axis + 2) % 3;
+    for (float dir : { 1.0f, -1.0f }) {
+      std::fill(depth.begin(), depth.end(), std::numeric_limits<float>::infinity());
+      for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+        glm::vec3 p[3];
+        for (int k = 0; k < 3; k++) {
+          glm::vec3 pos = (position(indices[i + k]) - min) * scale;
+          // Looking against the direction, so the larger coordinate is closer.
+          p[k] = { pos[u], pos[v], -dir * pos[axis] };
+        }
+        // Back faces (with respect to the view direction) are culled.
+        float area = (p[1].x - p[0].x) * (p[2].y - p[0].y) - (p[1].y - p[0].y) * (p[2].x - p[0].x);
+        if (area * dir <= 0.0f)
+          continue;
+        if (area < 0.0f) {
+          std::swap(p[1], p[2]);
+          area = -area;
+        }
+
+        int x0 = std::max(0, (int)std::floor(std::min({ p[0].x, p[1].x, p[2].x })));
+        int y0 = std::max(0, (int)std::floor(std::min({ p[0].y, p[1].y, p[2].y })));
+        int x1 = std::min(GRID - 1, (int)std::ceil(std::max({ p[0].x, p[1].x, p[2].x })));
+        int y1 = std::min(GRID - 1, (int)std::ceil(std::max({ p[0].y, p[1].y, p[2].y })));
+        for (int y = y0; y <= y1; y++) {
+          for (int x = x0; x <= x1; x++) {
+            float px = x + 0.5f, py = y + 0.5f;
+            float w0 = (p[2].x - p[1].x) * (py - p[1].y) - (p[2].y - p[1].y) * (px - p[1].x);
+            float w1 = (p[0].x - p[2].x) * (py - p[2].y) - (p[0].y - p[2].y) * (px - p[2].x);
+            float w2 = area - w0 - w1;
+            if (w0 < 0.0f || w1 < 0.0f || w2 < 0.0f)
+              continue;
+            float z = (w0 * p[0].z + w1 * p[1].z + w2 * p[2].z) / area;
+            float& d = depth[y * GRID + x];
+            if (z < d) {
+              d = z;
+              shaded++;
+            }
+          }
+        }
+      }
+      covered += std::count_if(depth.begin(), depth.end(), [](float d){ return !std::isinf(d); });
+    }
+  }
+  return covered > 0 ? (float)shaded / covered : 1.0f;
+}
+
+/// Score of a vertex for the cache optimization. Triangles with higher score of their vertices are emitted first.
+static float vertex_score(int cache_position, uint32_t remaining_triangles) {
+  if (remaining_triangles == 0)
+    return -1.0f;
+
+  float score = 0.0f;
+  if (cache_position >= 0) {
+    // Vertices of the last triangle get a fixed score, so the next triangle doesn't just reuse its edge.
+    if (cache_position < 3)
+      score = 0.75f;
+    else
+      score = std::pow(1.0f - (float)(cache_position - 3) / (CACHE_SIZE - 3), 1.5f);
+  }
+  // Boost vertices with few remaining triangles, so they are finished and don't need to be shaded again.
+  return score + 2.0f / std::sqrt((float)remaining_triangles);
+}
+
+MeshOptimizeReport MeshOptimizer::OptimizeVertexCache() {
+  MeshOptimizeReport report;
+  report.before = Analyze();
+
+  const uint32_t triangle_count = indices.size() / 3;
+  const uint32_t vertex_count = vertexCount();
+
+  // Triangles of each vertex. The first `remaining[v]` of them aren't emitted yet.
+  std::vector<uint32_t> remaining(vertex_count, 0);
+  for (uint32_t i = 0; i < triangle_count * 3; i++)
+    remaining[indices[i]]++;
+  std::vector<uint32_t> offsets(vertex_count + 1, 0);
+  std::partial_sum(remaining.begin(), remaining.end(), offsets.begin() + 1);
+  std::vector<uint32_t> adjacency(triangle_count * 3);
+  {
+    std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+    for (uint32_t i = 0; i < triangle_count * 3; i++)
+      adjacency[fill[indices[i]]++] = i / 3;
+  }
+
+  std::vector<int> cache_position(vertex_count, -1);
+  std::vector<float> score(vertex_count);
+  for (uint32_t v = 0; v < vertex_count; v++)
+    score[v] = vertex_score(-1, remaining[v]);
+  std::vector<float> triangle_score(triangle_count);
+  for (uint32_t t = 0; t < triangle_count; t++)
+    triangle_score[t] = score[indices[t * 3]] + score[indices[t * 3 + 1]] + score[indices[t * 3 + 2]];
+  std::vector<bool> emitted(triangle_count, false);
+
+  // LRU cache. It temporarily holds the 3 extra vertices pushed out by the emitted triangle.
+  std::vector<uint32_t> cache, new_cache;
+  cache.reserve(CACHE_SIZE + 3);
+  new_cache.reserve(CACHE_SIZE + 3);
+
+  IndexBuffer::Data result;
+  result.reserve(triangle_count * 3);
+  int64_t best = -1;
+  uint32_t next_unemitted = 0;
+  for (uint32_t n = 0; n < triangle_count; n++) {
+    if (best < 0) {
+      // No triangle of the cached vertices is left, so continue with the input order.
+      while (emitted[next_unemitted])
+        next_unemitted++;
+      best = next_unemitted;
+    }
+
+    const uint32_t* tri = &indices[best * 3];
+    result.insert(result.end(), tri, tri + 3);
+    emitted[best] = true;
+
+    new_cache.clear();
+    for (int k = 0; k < 3; k++) {
+      uint32_t v = tri[k];
+      uint32_t* first = &adjacency[offsets[v]];
+      std::swap(*std::find(first, first + remaining[v], (uint32_t)best), first[remaining[v] - 1]);
+      remaining[v]--;
+      new_cache.push_back(v);
+    }
+    // Degenerate triangles would put their vertex into the cache twice.
+    new_cache.erase(std::unique(new_cache.begin(), new_cache.end()), new_cache.end());
+    if (new_cache.size() == 3 && new_cache[0] == new_cache[2])
+      new_cache.pop_back();
+    for (uint32_t v : cache) {
+      if (v != tri[0] && v != tri[1] && v != tri[2])
+        new_cache.push_back(v);
+    }
+
+    for (size_t i = 0; i < new_cache.size(); i++) {
+      uint32_t v = new_cache[i];
+      cache_position[v] = i < CACHE_SIZE ? (int)i : -1;
+      score[v] = vertex_score(cache_position[v], remaining[v]);
+    }
+
+    // Only the triangles of the cached vertices changed their score. The best of them goes next.
+    best = -1;
+    float best_score = -1.0f;
+    for (size_t i = 0; i < new_cache.size(); i++) {
+      uint32_t v = new_cache[i];
+      for (uint32_t j = 0; j < remaining[v]; j++) {
+        uint32_t t = adjacency[offsets[v] + j];
+        const uint32_t* vs = &indices[t * 3];
+        triangle_score[t] = score[vs[0]] + score[vs[1]] + score[vs[2]];
+        if (i < CACHE_SIZE && triangle_score[t] > best_score) {
+          best_score = triangle_score[t];
+          best = t;
+        }
+      }
+    }
+
+    new_cache.resize(std::min<size_t>(new_cache.size(), CACHE_SIZE));
+    std::swap(cache, new_cache);
+  }
+
+  indices = std::move(result);
+  report.after = Analyze();
+  return report;
+}
+
+MeshOptimizeReport MeshOptimizer::OptimizeOverdraw(float threshold) {
+  MeshOptimizeReport report;
+  report.before = Analyze();
+
+  const uint32_t triangle_count = indices.size() / 3;
+  if (triangle_count == 0) {
+    report.after = report.before;
+    return report;
+  }
+
+  // Hard boundaries, where the cache restarts (all vertices of the triangle miss).
+  CacheSim cache(vertexCount());
+  std::vector<uint32_t> hard;
+  for (uint32_t t = 0; t < triangle_count; t++) {
+    if (cache.AccessTriangle(&indices[t * 3]) == 3 || t == 0)
+      hard.push_back(t);
+  }
+  hard.push_back(triangle_count);
+
+  // Soft boundaries split the clusters further while their ACMR stays low enough.
+  std::vector<uint32_t> clusters;
+  for (size_t c = 0; c + 1 < hard.size(); c++) {
+    const uint32_t begin = hard[c], end = hard[c + 1];
+    cache.Reset();
+    uint32_t misses = 0;
+    for (uint32_t t = begin; t < end; t++)
+      misses += cache.AccessTriangle(&indices[t * 3]);
+    const float max_acmr = threshold * misses / (end - begin);
+
+    cache.Reset();
+    uint32_t start = begin;
+    misses = 0;
+    clusters.push_back(begin);
+    for (uint32_t t = begin; t < end; t++) {
+      misses += cache.AccessTriangle(&indices[t * 3]);
+      if (t + 1 < end && (float)misses / (t - start + 1) <= max_acmr) {
+        start = t + 1;
+        misses = 0;
+        cache.Reset();
+        clusters.push_back(start);
+      }
+    }
+  }
+  clusters.push_back(triangle_count);
+
+  // Area weighted centroid and normal of the triangles.
+  const auto accumulate = [&](uint32_t begin, uint32_t end, glm::vec3& centroid, glm::vec3& normal) {
+    float area = 0.0f;
+    centroid = glm::vec3(0.0f);
+    normal = glm::vec3(0.0f);
+    for (uint32_t t = begin; t < end; t++) {
+      glm::vec3 a = position(indices[t * 3]), b = position(indices[t * 3 + 1]), c = position(indices[t * 3 + 2]);
+      glm::vec3 n = glm::cross(b - a, c - a);
+      float w = glm::length(n);
+      centroid += w * (a + b + c) / 3.0f;
+      normal += n;
+      area += w;
+    }
+    if (area > 0.0f)
+      centroid /= area;
+  };
+  glm::vec3 mesh_centroid, mesh_normal;
+  accumulate(0, triangle_count, mesh_centroid, mesh_normal);
+
+  // Clusters on the outside of the mesh, facing away from its center, tend to occlude the rest.
+  struct Cluster {
+    uint32_t begin, end;
+    float sort_key;
+  };
+  std::vector<Cluster> sorted;
+  for (size_t c = 0; c + 1 < clusters.size(); c++) {
+    glm::vec3 centroid, normal;
+    accumulate(clusters[c], clusters[c + 1], centroid, normal);
+    float length = glm::length(normal);
+    float key = length > 0.0f ? glm::dot(centroid - mesh_centroid, normal / length) : 0.0f;
+    sorted.push_back({ clusters[c], clusters[c + 1], key });
+  }
+  std::stable_sort(sorted.begin(), sorted.end(), [](const Cluster& a, const Cluster& b){ return a.sort_key > b.sort_key; });
+
+  IndexBuffer::Data result;
+  result.reserve(indices.size());
+  for (const Cluster& cluster : sorted)
+    result.insert(result.end(), indices.begin() + cluster.begin * 3, indices.begin() + cluster.end * 3);
+  indices = std::move(result);
+
+  report.after = Analyze();
+  return report;
+}
+
+MeshOptimizeReport MeshOptimizer::OptimizeVertexFetch() {
+  MeshOptimizeReport report;
+  report.before = Analyze();
+
+  std::vector<uint32_t> remap(vertexCount(), UINT32_MAX);
+  VertexBuffer::Data result;
+  result.reserve(vertices.size());
+  uint32_t next = 0;
+  for (uint32_t& vertex : indices) {
+    if (remap[vertex] == UINT32_MAX) {
+      remap[vertex] = next++;
+      auto data = vertices.begin() + (size_t)vertex * m_stride;
+      result.insert(result.end(), data, data + m_stride);
+    }
+    vertex = remap[vertex];
+  }
+  vertices = std::move(result);
+
+  report.after = Analyze();
+  return report;
+}
+
+IndexBuffer::Data MeshOptimizer::Stripify() const {
+  const uint32_t triangle_count = indices.size() / 3;
+  const auto vertex = [&](uint32_t triangle, uint32_t corner) { return indices[triangle * 3 + corner % 3]; };
+  const auto edge_key = [](uint32_t from, uint32_t to) { return (uint64_t)from << 32 | to; };
+
+  // Directed edges of the triangles sorted by their vertices. The value is the triangle and the
+  // corner the edge starts at.
+  std::vector<std::pair<uint64_t, uint32_t>> edges;
+  edges.reserve(indices.size());
+  std::vector<bool> used(triangle_count, false);
+  for (uint32_t t = 0; t < triangle_count; t++) {
+    if (vertex(t, 0) == vertex(t, 1) || vertex(t, 1) == vertex(t, 2) || vertex(t, 2) == vertex(t, 0)) {
+      used[t] = true;
+      continue;
+    }
+    for (uint32_t corner = 0; corner < 3; corner++)
+      edges.push_back({ edge_key(vertex(t, corner), vertex(t, corner + 1)), t * 3 + corner });
+  }
+  std::sort(edges.begin(), edges.end());
+
+  // Find unused triangle with the directed edge. Returns its triangle and corner or UINT32_MAX.
+  uint32_t window_end = 0;
+  const auto find_triangle = [&](uint32_t from, uint32_t to) -> uint32_t {
+    const uint64_t key = edge_key(from, to);
+    auto it = std::lower_bound(edges.begin(), edges.end(), std::pair<uint64_t, uint32_t>(key, 0));
+    for (; it != edges.end() && it->first == key; ++it) {
+      if (!used[it->second / 3] && it->second / 3 < window_end)
+        return it->second;
+    }
+    return UINT32_MAX;
+  };
+
+  // Build strip starting with the triangle rotated to start at the corner. Marks the triangles as used.
+  const auto build_strip = [&](uint32_t triangle, uint32_t corner, std::vector<uint32_t>& strip,
+                               std::vector<uint32_t>& triangles) {
+    strip = { vertex(triangle, corner), vertex(triangle, corner + 1), vertex(triangle, corner + 2) };
+    triangles = { triangle };
+    used[triangle] = true;
+    while (true) {
+      // Odd triangles of the strip have their first two vertices swapped, so the shared edge is reversed.
+      const uint32_t a = strip[strip.size() - 2], b = strip.back();
+      const uint32_t next = strip.size() % 2 == 0 ? find_triangle(a, b) : find_triangle(b, a);
+      if (next == UINT32_MAX)
+        break;
+      strip.push_back(vertex(next / 3, next % 3 + 2));
+      triangles.push_back(next / 3);
+      used[next / 3] = true;
+    }
+  };
+
+  IndexBuffer::Data result;
+  result.reserve(indices.size());
+  std::vector<uint32_t> strip, triangles, best_strip, best_triangles;
+  for (uint32_t t = 0; t < triangle_count; t++) {
+    if (used[t])
+      continue;
+    window_end = std::min(t + STRIP_WINDOW, triangle_count);
+    // Try all rotations of the first triangle and keep the longest strip.
+    for (uint32_t corner = 0; corner < 3; corner++) {
+      build_strip(t, corner, strip, triangles);
+      for (uint32_t triangle : triangles)
+        used[triangle] = false;
+      if (strip.size() > best_strip.size()) {
+        std::swap(strip, best_strip);
+        std::swap(triangles, best_triangles);
+      }
+    }
+    for (uint32_t triangle : best_triangles)
+      used[triangle] = true;
+
+    if (!result.empty())
+      result.push_back(restart_index<uint32_t>());
+    result.insert(result.end(), best_strip.begin(), best_strip.end());
+    best_strip.clear();
+  }
+  return result;
+}
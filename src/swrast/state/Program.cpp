@@ -4,10 +4,20 @@
  * @file Program.cpp
  */
 #include "state/Program.h"
+#include <bit>
 #include <cstring>
 
 using namespace swrast;
 
+Program::Program(const ProgramSpec&& spec)
+  : m_uniforms(), m_vertexShader(spec.vertex_shader) , m_fragmentShader(spec.fragment_shader)
+  , m_varyings(spec.varyings), m_uniformBlocks()
+{
+  if (spec.uniform_blocks.size() > MAX_UNIFORM_BLOCKS)
+    RAISE(ProgramLinkException, "Too many uniform blocks");
+  std::copy(spec.uniform_blocks.begin(), spec.uniform_blocks.end(), m_uniformBlocks.begin());
+}
+
 Program& Program::Use() {
   State::SetActiveProgram(Id);
   return *this;
@@ -54,50 +64,232 @@ template<> ObjectHandle<Program> State::CreateObject(Program&& obj) {
   Program* ptr = &(State::m_programs.emplace(obj.Id, std::move(obj)).first->second);
   ptr->m_vertexShader->uniforms = &ptr->m_uniforms;
   ptr->m_fragmentShader->uniforms = &ptr->m_uniforms;
+  ptr->m_vertexShader->uniform_blocks = &ptr->m_uniformBlocks;
+  ptr->m_fragmentShader->uniform_blocks = &ptr->m_uniformBlocks;
+  ptr->m_vertexShader->varyings = &ptr->m_varyings;
+  ptr->m_fragmentShader->varyings = &ptr->m_varyings;
   return {
     .obj_ptr = ptr,
     .obj_id = obj.Id,
   };
 }
 
-template<> int32_t& Shader::getInOut(Shader::InOutVars* vars, StrId name) {
-  auto& v = (*vars)[name];
-  v.integer = true;
-  return v.i1;
+VaryingLayout::VaryingLayout(const std::vector<Varying>& varyings) {
+  if (varyings.size() > MAX_VARYINGS)
+    RAISE(ProgramLinkException, "Too many varyings");
+  for (const auto& var : varyings) {
+    if (Find(var.name).has_value())
+      RAISE(ProgramLinkException, "Varying declared multiple times");
+    m_varyings[m_count++] = var;
+  }
+}
+
+VaryingLayout::VaryingLayout(const VaryingLayout& other) : m_varyings(other.m_varyings), m_count(other.Size()) {}
+
+VaryingLayout& VaryingLayout::operator=(const VaryingLayout& other) {
+  m_varyings = other.m_varyings;
+  m_count.store(other.Size(), std::memory_order_release);
+  return *this;
+}
+
+VaryingSlot VaryingLayout::FindOrAdd(StrId name, VaryingType type) {
+  if (auto slot = Find(name))
+    return slot.value();
+  std::lock_guard lock(m_addMutex);
+  // Another invocation could add it meanwhile.
+  if (auto slot = Find(name))
+    return slot.value();
+  uint8_t count = Size();
+  if (count == MAX_VARYINGS)
+    RAISE(VaryingNotFoundException, name);
+  m_varyings[count] = { name, type };
+  // Readers see the new slot only after it's written.
+  m_count.store(count + 1, std::memory_order_release);
+  return VaryingSlot{ count };
+}
+
+void VertexBatch::SetLane(uint8_t lane, const glm::vec4& position, const Shader::InOutVars& vars) {
+  m_Position.SetLane(lane, position);
+  uint8_t count = m_varyings ? m_varyings->Size() : 0;
+  for (uint8_t i = 0; i < count; i++)
+    m_out[i].SetLane(lane, vars[i].f4);
+}
+
+void VertexBatch::GetLane(uint8_t lane, glm::vec4& position, Shader::InOutVars& vars) const {
+  position = m_Position.Lane(lane);
+  uint8_t count = m_varyings ? m_varyings->Size() : 0;
+  for (uint8_t i = 0; i < count; i++)
+    vars[i].f4 = m_out[i].Lane(lane);
+}
+
+void VertexContext::Bind(const VertexShader* shader, const std::vector<AttributeStream>* streams) {
+  m_shader = shader;
+  m_streams = streams;
+  if (m_scratch.size() < streams->size())
+    m_scratch.resize(streams->size());
+}
+
+void VertexShader::Execute(VertexContext& ctx) const {
+  if (m_func) {
+    m_func(&ctx);
+    return;
+  }
+
+  // Batched shader executed for a single vertex.
+  VertexBatch& batch = ctx.m_singleBatch;
+  batch.m_Count = 1;
+  batch.m_VertexId.fill(ctx.m_VertexId);
+  ExecuteBatch(ctx, batch);
+  batch.GetLane(0, ctx.m_Position, ctx.OutVars());
+}
+
+void VertexShader::ExecuteBatch(VertexContext& ctx, VertexBatch& batch) const {
+  batch.m_streams = ctx.m_streams;
+  batch.m_varyings = varyings;
+  batch.m_InstanceId = ctx.m_InstanceId;
+  if (m_batchFunc) {
+    m_batchFunc(&ctx, batch);
+    return;
+  }
+
+  // Single vertex shader executed for each lane.
+  for (uint8_t lane = 0; lane < batch.m_Count; lane++) {
+    ctx.m_VertexId = batch.m_VertexId[lane];
+    m_func(&ctx);
+    batch.SetLane(lane, ctx.m_Position, ctx.OutVars());
+  }
 }
-template<> glm::ivec2& Shader::getInOut(Shader::InOutVars* vars, StrId name) {
-  auto& v = (*vars)[name];
-  v.integer = true;
-  return v.i2;
+
+void FragmentBatch::SetLaneInputs(uint8_t lane, const Shader::InOutVars& vars) {
+  uint8_t count = m_varyings ? m_varyings->Size() : 0;
+  for (uint8_t i = 0; i < count; i++)
+    m_in[i].SetLane(lane, vars[i].f4);
+}
+
+void FragmentBatch::GetLaneInputs(uint8_t lane, Shader::InOutVars& vars) const {
+  uint8_t count = m_varyings ? m_varyings->Size() : 0;
+  for (uint8_t i = 0; i < count; i++)
+    vars[i].f4 = m_in[i].Lane(lane);
 }
-template<> glm::ivec3& Shader::getInOut(Shader::InOutVars* vars, StrId name) {
-  auto& v = (*vars)[name];
-  v.integer = true;
-  return v.i3;
+
+void FragmentShader::Execute(FragmentContext& ctx) const {
+  ctx.m_discarded = false;
+  if (m_func) {
+    m_func(&ctx);
+    return;
+  }
+
+  // Batched shader executed for a single fragment. All lanes are the same, so derivatives are zero.
+  FragmentBatch& batch = ctx.m_singleBatch;
+  batch.m_varyings = varyings;
+  batch.m_Mask = 1;
+  batch.m_FragCoord = WVec4(ctx.m_FragCoord);
+  for (uint8_t lane = 0; lane < WIDE_LANES; lane++)
+    batch.SetLaneInputs(lane, ctx.InVars());
+  batch.m_FragDepth = WFloat(ctx.m_FragCoord.z);
+  m_batchFunc(&ctx, batch);
+  ctx.m_discarded = !(batch.m_Mask & 1);
+  ctx.m_FragColor = batch.m_FragColor.Lane(0);
+  ctx.m_FragDepth = batch.m_FragDepth[0];
 }
-template<> glm::ivec4& Shader::getInOut(Shader::InOutVars* vars, StrId name) {
-  auto& v = (*vars)[name];
-  v.integer = true;
-  return v.i4;
+
+void FragmentShader::ExecuteBatch(FragmentContext& ctx, FragmentBatch& batch) const {
+  batch.m_varyings = varyings;
+  if (m_batchFunc) {
+    m_batchFunc(&ctx, batch);
+    return;
+  }
+
+  // Single fragment shader executed for each quad of the batch, which has a covered pixel.
+  constexpr uint8_t QUAD_LANES = FragmentContext::QUAD_LANES;
+  if (!batch.m_Quads) {
+    // Lanes are separate pixels. All lanes of the context quad get the same inputs, so the
+    // derivatives are zero, but only the first one is shaded.
+    for (uint8_t lanes = batch.m_Mask; lanes; lanes &= lanes - 1) {
+      const uint8_t lane = std::countr_zero(lanes);
+      ctx.m_QuadMask = 1;
+      for (uint8_t i = 0; i < QUAD_LANES; i++) {
+        ctx.m_QuadFragCoord[i] = batch.m_FragCoord.Lane(lane);
+        batch.GetLaneInputs(lane, ctx.QuadInVars(i));
+      }
+      executeLane(ctx, 0);
+      batch.m_FragColor.SetLane(lane, ctx.m_QuadFragColor[0]);
+      batch.m_FragDepth[lane] = ctx.m_QuadFragDepth[0];
+      if (!(ctx.m_QuadMask & 1))
+        batch.m_Mask &= ~(1 << lane);
+    }
+    return;
+  }
+  for (uint8_t quad = 0; quad < 2; quad++) {
+    // Batch lanes of the quad lanes.
+    const uint8_t first = quad * 2;
+    const std::array<uint8_t, QUAD_LANES> lanes = {
+      first, uint8_t(first + 1), uint8_t(first + FragmentBatch::WIDTH), uint8_t(first + FragmentBatch::WIDTH + 1)
+    };
+    ctx.m_QuadMask = 0;
+    for (uint8_t i = 0; i < QUAD_LANES; i++) {
+      if (batch.m_Mask & (1 << lanes[i]))
+        ctx.m_QuadMask |= 1 << i;
+    }
+    if (ctx.m_QuadMask == 0)
+      continue;
+
+    for (uint8_t i = 0; i < QUAD_LANES; i++) {
+      ctx.m_QuadFragCoord[i] = batch.m_FragCoord.Lane(lanes[i]);
+      batch.GetLaneInputs(lanes[i], ctx.QuadInVars(i));
+    }
+    ExecuteQuad(ctx);
+    for (uint8_t i = 0; i < QUAD_LANES; i++) {
+      batch.m_FragColor.SetLane(lanes[i], ctx.m_QuadFragColor[i]);
+      batch.m_FragDepth[lanes[i]] = ctx.m_QuadFragDepth[i];
+      if (!(ctx.m_QuadMask & (1 << i)))
+        batch.m_Mask &= ~(1 << lanes[i]);
+    }
+  }
 }
-template<> float& Shader::getInOut(Shader::InOutVars* vars, StrId name) {
-  auto& v = (*vars)[name];
-  v.integer = false;
-  return v.f1;
+
+void FragmentShader::ExecuteQuad(FragmentContext& ctx) const {
+  assert(m_func && "Quad shading needs the single fragment entry point");
+  for (uint8_t lane = 0; lane < FragmentContext::QUAD_LANES; lane++)
+    executeLane(ctx, lane);
 }
-template<> glm::vec2& Shader::getInOut(Shader::InOutVars* vars, StrId name) {
-  auto& v = (*vars)[name];
-  v.integer = false;
-  return v.f2;
+
+void FragmentShader::executeLane(FragmentContext& ctx, uint8_t lane) const {
+  // Move the lane inputs into the context, so In() works as for a single fragment.
+  ctx.swapInputs(lane);
+  ctx.m_quadLane = lane;
+  ctx.m_FragCoord = ctx.m_QuadFragCoord[lane];
+  ctx.m_HelperInvocation = !(ctx.m_QuadMask & (1 << lane));
+  ctx.m_FragDepth = ctx.m_FragCoord.z;
+  ctx.m_discarded = false;
+  m_func(&ctx);
+  // Discarded fragments turn into helpers.
+  if (ctx.m_discarded)
+    ctx.m_QuadMask &= ~(1 << lane);
+  ctx.m_QuadFragColor[lane] = ctx.m_FragColor;
+  ctx.m_QuadFragDepth[lane] = ctx.m_FragDepth;
+  ctx.m_quadLane = FragmentContext::QUAD_LANES;
+  ctx.swapInputs(lane);
 }
-template<> glm::vec3& Shader::getInOut(Shader::InOutVars* vars, StrId name) {
-  auto& v = (*vars)[name];
-  v.integer = false;
-  return v.f3;
+
+VaryingSlot Shader::GetVaryingSlot(StrId name) const {
+  auto slot = varyings ? varyings->Find(name) : Opt<VaryingSlot>();
+  if (!slot.has_value())
+    RAISE(VaryingNotFoundException, name);
+  return slot.value();
 }
-template<> glm::vec4& Shader::getInOut(Shader::InOutVars* vars, StrId name) {
-  auto& v = (*vars)[name];
-  v.integer = false;
-  return v.f4;
+
+VaryingSlot Shader::GetVaryingSlot(StrId name, VaryingType type) const {
+  if (!varyings)
+    RAISE(VaryingNotFoundException, name);
+  return varyings->FindOrAdd(name, type);
 }
 
+template<> int32_t& ShaderContext::getInOut(InOutVars* vars, VaryingSlot slot) { return (*vars)[slot.index].i1; }
+template<> glm::ivec2& ShaderContext::getInOut(InOutVars* vars, VaryingSlot slot) { return (*vars)[slot.index].i2; }
+template<> glm::ivec3& ShaderContext::getInOut(InOutVars* vars, VaryingSlot slot) { return (*vars)[slot.index].i3; }
+template<> glm::ivec4& ShaderContext::getInOut(InOutVars* vars, VaryingSlot slot) { return (*vars)[slot.index].i4; }
+template<> float& ShaderContext::getInOut(InOutVars* vars, VaryingSlot slot) { return (*vars)[slot.index].f1; }
+template<> glm::vec2& ShaderContext::getInOut(InOutVars* vars, VaryingSlot slot) { return (*vars)[slot.index].f2; }
+template<> glm::vec3& ShaderContext::getInOut(InOutVars* vars, VaryingSlot slot) { return (*vars)[slot.index].f3; }
+template<> glm::vec4& ShaderContext::getInOut(InOutVars* vars, VaryingSlot slot) { return (*vars)[slot.index].f4; }
@@ -8,6 +8,8 @@
 #include "state/VertexArray.h"
 #include "state/VertexBuffer.h"
 #include "state/IndexBuffer.h"
+#include "state/IndirectBuffer.h"
+#include "state/UniformBuffer.h"
 #include "state/Texture.h"
 #include "state/Framebuffer.h"
 #include "state/Program.h"
@@ -18,6 +20,8 @@ using namespace swrast;
 // Initialization of static member variables.
 std::unordered_map<ObjectId, VertexBuffer> swrast::State::m_vbos = {};
 std::unordered_map<ObjectId, IndexBuffer> swrast::State::m_ibos = {};
+std::unordered_map<ObjectId, IndirectBuffer> swrast::State::m_indirectBufs = {};
+std::unordered_map<ObjectId, UniformBuffer> swrast::State::m_ubos = {};
 std::unordered_map<ObjectId, VertexArray> swrast::State::m_vaos;
 std::unordered_map<ObjectId, Texture> swrast::State::m_textures = {};
 std::unordered_map<ObjectId, Framebuffer> swrast::State::m_fbos = {};
@@ -28,7 +32,9 @@ ObjectId swrast::State::m_defaultFb = 0;
 Opt<ObjectId> swrast::State::m_activeProgram = {};
 Opt<ObjectId> swrast::State::m_activeVao = {};
 
-void State::Init(glm::uvec2 fb_size) {
+void State::Init(glm::uvec2 fb_size, const StateSpec& spec) {
+  RenderState::Init(spec);
+
   // Create default framebuffer.
   auto default_fb = CreateObject<Framebuffer>(Framebuffer(fb_size, {
     .depth_buffer = CreateObject<Texture>(Texture({}, fb_size, TexFormat::rgba)),
@@ -38,35 +44,75 @@ void State::Init(glm::uvec2 fb_size) {
   m_activeFb = m_defaultFb;
 }
 void State::Destroy() {
+  RenderState::Destroy();
   m_fbos.clear();
   m_vaos.clear();
   m_programs.clear();
   m_shaders.clear();
   m_vbos.clear();
   m_ibos.clear();
+  m_indirectBufs.clear();
+  m_ubos.clear();
   m_textures.clear();
   m_activeFb = 0;
   m_defaultFb = 0;
 }
 
+/// Create record of the draw. The range has to be addressable by the 32-bit vertex IDs and indices.
+static DrawRecord make_draw_record(size_t offset, size_t count, int32_t base_vertex) {
+  if ((uint64_t)offset + count > (uint64_t)UINT32_MAX + 1)
+    RAISE(DrawRangeException, offset, count, UINT32_MAX);
+  return { (uint32_t)count, (uint32_t)offset, base_vertex };
+}
+
 void State::DrawArrays(Primitive primitive, size_t offset, size_t count) {
+  DrawRecord draw = make_draw_record(offset, count, 0);
+  MultiDrawArrays(primitive, { &draw, 1 });
+}
+void State::DrawIndexed(Primitive primitive, size_t count, size_t offset, int32_t base_vertex) {
+  DrawRecord draw = make_draw_record(offset, count, base_vertex);
+  MultiDrawIndexed(primitive, { &draw, 1 });
+}
+void State::DrawArraysInstanced(Primitive primitive, size_t offset, size_t count, uint32_t instance_count) {
+  DrawRecord draw = make_draw_record(offset, count, 0);
+  RenderCommand cmd = {
+    .draw_primitive = primitive,
+    .is_indexed = false,
+    .draws = { &draw, 1 },
+    .instance_count = instance_count,
+  };
+  RenderState::Draw(cmd);
+}
+void State::DrawIndexedInstanced(Primitive primitive, size_t count, uint32_t instance_count, size_t offset,
+                                 int32_t base_vertex) {
+  DrawRecord draw = make_draw_record(offset, count, base_vertex);
+  RenderCommand cmd = {
+    .draw_primitive = primitive,
+    .is_indexed = true,
+    .draws = { &draw, 1 },
+    .instance_count = instance_count,
+  };
+  RenderState::Draw(cmd);
+}
+void State::MultiDrawArrays(Primitive primitive, std::span<const DrawRecord> draws) {
   RenderCommand cmd = {
     .draw_primitive = primitive,
     .is_indexed = false,
-    .count = count,
-    .offset = offset,
+    .draws = draws,
   };
   RenderState::Draw(cmd);
 }
-void State::DrawIndexed(Primitive primitive, size_t count) {
+void State::MultiDrawIndexed(Primitive primitive, std::span<const DrawRecord> draws) {
   RenderCommand cmd = {
     .draw_primitive = primitive,
     .is_indexed = true,
-    .count = count,
-    .offset = 0,
+    .draws = draws,
   };
   RenderState::Draw(cmd);
 }
+void State::MultiDrawIndexedIndirect(Primitive primitive, const ObjectHandle<IndirectBuffer>& draws) {
+  MultiDrawIndexed(primitive, draws->data);
+}
 
 void State::SetActiveFramebuffer(Opt<ObjectId> fb_id) {
   if (fb_id.has_value()) {
@@ -0,0 +1,24 @@
+/**
+ * @brief Implementation of state/UniformBuffer.h
+ * @file state/UniformBuffer.cpp
+ * @author Jakub Kloub, xkloub03, VUT FIT
+ */
+#include "state/UniformBuffer.h"
+#include "state/State.h"
+
+using namespace swrast;
+
+template<>
+OptRef<UniformBuffer> State::GetObject(ObjectId id) {
+  if (State::m_ubos.count(id) == 0)
+    return {};
+  return OptRef<UniformBuffer>(m_ubos[id]);
+}
+
+template<>
+ObjectHandle<UniformBuffer> State::CreateObject(UniformBuffer&& ubo) {
+  return {
+    .obj_ptr = &(State::m_ubos.emplace(ubo.Id, std::move(ubo)).first->second),
+    .obj_id = ubo.Id,
+  };
+}
@@ -22,6 +22,24 @@ void VertexArray::AddAttribute(const VertexAttribute &attr) {
   m_attribs.push_back(attr);
 }
 
+std::vector<AttributeStream> VertexArray::GetStreams() const {
+  std::vector<AttributeStream> streams;
+  streams.reserve(m_attribs.size());
+  for (const auto& attr : m_attribs) {
+    const auto& data = attr.vbo->data;
+    size_t bytes = data.size() * sizeof(float);
+    streams.push_back({
+      .data = reinterpret_cast<const uint8_t*>(data.data()) + attr.offset,
+      .stride = attr.stride,
+      .type = attr.type,
+      .size = bytes > attr.offset ? bytes - attr.offset : 0,
+      .divisor = attr.divisor,
+      .fetch = nullptr,
+    });
+  }
+  return streams;
+}
+
 void VertexArray::Use() {
   State::SetActiveVertexArray(Id);
 }